@@ -0,0 +1,24 @@
+/*
+ * Triple Color E-Ink Display, asynchronous interface
+ *
+ * Copyright (C) 2019 Seeed Studio
+ *
+ * Released under the GPL
+ *
+ * The image is built in a back buffer, by write()/lseek() or in an
+ * mmap() of the device (offset 0, the image size). EINK_IOC_SUBMIT
+ * hands it to the kernel and returns at once; the back buffer can be
+ * reused immediately. poll() reports POLLOUT once the panel shows the
+ * last image submitted, POLLERR with it if that upload failed, and
+ * O_ASYNC gets SIGIO then. fsync() submits and waits.
+ */
+#ifndef _EINK_IOCTL_H_
+#define _EINK_IOCTL_H_
+
+#include <linux/ioctl.h>
+
+#define EINK_IOC_MAGIC		'e'
+/* no argument */
+#define EINK_IOC_SUBMIT		_IO(EINK_IOC_MAGIC, 0)
+
+#endif
@@ -19,44 +19,59 @@
 #include <linux/mutex.h>
 #include <linux/of.h>
 #include <linux/slab.h>
-#include <linux/platform_device.h>
 #include <linux/miscdevice.h>
-#include <linux/termios.h>
 #include <linux/delay.h>
 #include <linux/sched.h>
-#include <asm/ioctls.h>
-#include <linux/serial.h>
+#include <linux/completion.h>
+#include <linux/serdev.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include <linux/poll.h>
+#include <linux/workqueue.h>
+
+#include "eink-ioctl.h"
 
 #define DEFAULT_BAUDRATE	230400
-#define DEFAULT_TTY		"/dev/ttyS4"
 #define DEFAULT_LINE_LEN	152
 #define DEFAULT_LINES		152
 
 #define EINK_HDR		'a'
 #define EINK_HDR_RSP		'b'
 
-#define EINK_CHK_PROGRESS	0
 #define EINK_TAG_NEXT		"NEXT!"
 #define EINK_TAG_DONE		"DONE!"
 #define EINK_TAG_DBG		0
+#define EINK_TAG_LEN		20
+#define EINK_TAG_TIMEOUT	100  /* ms */
 #define EINK_TIMEOUT		3000 /* ms */
 
 #define EINK_LINE_DLY		48   /* ms */
+#define EINK_WRITE_TIMEOUT	1000 /* ms */
 
-#define EINK_POLL_WAIT		0
+static bool handshake = true;
+module_param(handshake, bool, 0644);
+MODULE_PARM_DESC(handshake, "Pace chunks by the NEXT!/DONE! tags of the firmware, "
+		 "a fixed delay if it sends none");
 
 /*
  * This driver creates a character device (/dev/eink) which exposes the
  * Triple Color E-ink Display
+ *
+ * Writes only go to an image buffer, at the file position, so a region
+ * can be changed with lseek() + write(), or to an mmap() of it. A submit
+ * (EINK_IOC_SUBMIT, fsync() or close()) copies it to a second buffer
+ * that upload_work sends to the panel in the background, unless it is
+ * the image the panel already shows.
+ * The firmware only takes whole images. See eink-ioctl.h.
  */
 
 struct eink_dev {
 	/* misc device descriptor */
 	struct miscdevice miscdev;
 
-	/* port (/dev/ttyS1 eg.) & speed (115200 eg.)*/
-	const char* tty_port;
+	/* the UART the panel hangs off & speed (115200 eg.)*/
+	struct serdev_device *serdev;
 	u32	baudrate;
 
 	/* locks */
@@ -66,352 +81,360 @@ struct eink_dev {
 	u32	line_len, num_lines;
 	u32	size;
 
-	/* tty port info */
-	struct file* tty;
-
-	/* bytes left to written of one display data image */
-	int bytes_left;
+	/* image being built, the one being sent, the one on the panel */
+	u8*	image;
+	u8*	sending;
+	u8*	shown;
+	bool	shown_valid;
+
+	/* image & the flags below, against upload_work */
+	struct mutex buf_lock;
+	struct work_struct upload_work;
+	bool	submitted;	/* image waits to be sent */
+	bool	busy;		/* submitted or being sent */
+	int	result;		/* of the last upload */
+	wait_queue_head_t wait;
+	struct fasync_struct *fasync;
+
+	/*
+	 * Receive side, fed by eink_receive_buf():
+	 * the response to a header, then a count of progress tags.
+	 */
+	bool	wait_hdr;
+	u8	hdr_rsp;
+	struct completion hdr_done;
+	struct completion progress;
+	bool	no_tags;
+	char	tag[EINK_TAG_LEN];
+	int	tag_len;
 };
 #define to_eink_dev(dev)  container_of((dev), struct eink_dev, miscdev)
 static int dev_index = 0;
 
-static long eink_tty_ioctl(struct file *f, unsigned int op,
-				 unsigned long param)
+/*
+ * serdev receive callback, the firmware talks in bytes and lines only
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+static size_t eink_receive_buf(struct serdev_device *serdev, const u8 *buf,
+			       size_t count)
+#else
+static int eink_receive_buf(struct serdev_device *serdev, const unsigned char *buf,
+			    size_t count)
+#endif
 {
-	if (f->f_op->unlocked_ioctl)
-		return f->f_op->unlocked_ioctl(f, op, param);
+	struct eink_dev *edev = serdev_device_get_drvdata(serdev);
+	size_t i;
+	u8 ch;
 
-	return -ENOTTY;
-}
+	for (i = 0; i < count; i++) {
+		ch = buf[i];
 
-static int eink_tty_write(struct file *f, unsigned char *buf, int count)
-{
-	loff_t pos = 0;
-	return kernel_write(f, buf, count, &pos);
-}
+		#if EINK_TAG_DBG
+		pr_info("R %c x%02X\n", ch, ch);
+		#endif
 
-#if EINK_POLL_WAIT
-static void eink_tty_read_poll_wait(struct file *f, int timeout)
-{
-	struct poll_wqueues table;
-	ktime_t start, now;
-
-	start = ktime_get();
-	poll_initwait(&table);
-	while (1) {
-		long elapsed;
-		int mask;
-
-		mask = f->f_op->poll(f, &table.pt);
-		if (mask & (POLLRDNORM | POLLRDBAND | POLLIN |
-			    POLLHUP | POLLERR)) {
-			break;
+		if (READ_ONCE(edev->wait_hdr)) {
+			edev->hdr_rsp = ch;
+			WRITE_ONCE(edev->wait_hdr, false);
+			complete(&edev->hdr_done);
+			continue;
+		}
+
+		if (ch == '\r' || ch == '\n') {
+			edev->tag[edev->tag_len] = '\0';
+			if (!strcmp(edev->tag, EINK_TAG_NEXT) ||
+			    !strcmp(edev->tag, EINK_TAG_DONE)) {
+				complete(&edev->progress);
+			}
+			edev->tag_len = 0;
+		} else if (edev->tag_len < EINK_TAG_LEN - 1) {
+			edev->tag[edev->tag_len++] = ch;
 		}
-		now = ktime_get();
-		elapsed = ktime_us_delta(now, start);
-		if (elapsed > timeout)
-			break;
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule_timeout(((timeout - elapsed) * HZ) / 10000);
 	}
-	poll_freewait(&table);
+	return count;
 }
-#endif
 
-static int eink_tty_read(struct file *f, int timeout)
+static const struct serdev_device_ops eink_serdev_ops = {
+	.receive_buf	= eink_receive_buf,
+	.write_wakeup	= serdev_device_write_wakeup,
+};
+
+static int eink_tty_write(struct eink_dev *edev, const u8 *buf, int count)
 {
-	unsigned char ch;
 	int rc;
-	loff_t pos = 0;
 
-	rc = -ETIMEDOUT;
-	if (IS_ERR(f)) {
-		return -EINVAL;
+	rc = serdev_device_write(edev->serdev, buf, count,
+				 msecs_to_jiffies(EINK_WRITE_TIMEOUT));
+	if (rc < 0) {
+		return rc;
 	}
+	serdev_device_wait_until_sent(edev->serdev, 0);
+	return rc ? rc : -ETIMEDOUT;
+}
 
-	#if EINK_POLL_WAIT
-	if (f->f_op->poll) {
-		eink_tty_read_poll_wait(f, timeout);
+/*
+ * Wait for the firmware to take a chunk, NEXT! or DONE! on a line.
+ * Firmware bug: it still burns the chunk to flash afterwards, so only
+ * what is left of EINK_LINE_DLY since the chunk was sent is slept.
+ */
+static int eink_check_progress(struct eink_dev *edev, unsigned long start) {
+	unsigned elapsed;
 
-		if (kernel_read(f, &ch, 1, &pos) == 1)
-			rc = ch;
+	if (!wait_for_completion_timeout(&edev->progress,
+					 msecs_to_jiffies(EINK_TAG_TIMEOUT))) {
+		return -ETIMEDOUT;
 	}
-	else
-	#endif
-	{
-		/* Device does not support poll, busy wait */
-		int retries = 0;
-
-		while (1) {
-			if (kernel_read(f, &ch, 1, &pos) == 1) {
-				rc = ch;
-				break;
-			}
 
-			if (++retries > timeout) {
-				break;
-			}
-			usleep_range(800, 1200);
-		}
+	elapsed = jiffies_to_msecs(jiffies - start);
+	if (elapsed < EINK_LINE_DLY) {
+		msleep(EINK_LINE_DLY - elapsed);
 	}
-	return rc;
+	return 0;
 }
 
-static int eink_tty_block(struct file *f) {
-	mm_segment_t oldfs;
-	int fl;
+/*
+ * header & response protocol
+ */
+static int eink_send_header(struct eink_dev *edev) {
+	u8 header = EINK_HDR;
+	int rc;
+
+	/* whatever came before is of no interest */
+	reinit_completion(&edev->hdr_done);
+	WRITE_ONCE(edev->wait_hdr, true);
+
+	if ((rc = eink_tty_write(edev, &header, sizeof header)) < 0) {
+		pr_info("write e-ink error = %d\n", rc);
+		goto fail;
+	}
 
-	oldfs = get_fs();
+	if (!wait_for_completion_timeout(&edev->hdr_done,
+					 msecs_to_jiffies(EINK_TIMEOUT))) {
+		pr_info("read e-ink error = %d\n", -ETIMEDOUT);
+		rc = -ETIMEDOUT;
+		goto fail;
+	}
 
-	/* Set fd block */
-	fl = eink_tty_ioctl(f, F_GETFL, 0);
-	if (fl == -1) {
-		return fl;
+	if (edev->hdr_rsp != EINK_HDR_RSP) {
+		pr_info("invalid response = 0x%02x\n", edev->hdr_rsp);
+		return -ENODEV;
 	}
-	fl &= ~O_NONBLOCK;
 
-	set_fs(KERNEL_DS);
-	eink_tty_ioctl(f, F_SETFL, (unsigned)fl);
-	set_fs(oldfs);
+	/* tags only count from the image on */
+	reinit_completion(&edev->progress);
 	return 0;
+
+fail:
+	WRITE_ONCE(edev->wait_hdr, false);
+	return rc;
 }
 
-static int eink_tty_setspeed(struct file *f, int speed)
-{
-	struct termios termios;
-	struct serial_struct serial;
-	mm_segment_t oldfs;
-
-	oldfs = get_fs();
-	set_fs(KERNEL_DS);
-
-	/* Set speed */
-	eink_tty_ioctl(f, TCGETS, (unsigned long)&termios);
-	termios.c_iflag = 0;
-	termios.c_oflag = 0;
-	termios.c_lflag = 0;
-	termios.c_cflag = CLOCAL | CS8 | CREAD;
-	termios.c_cc[VMIN] = 1;
-	termios.c_cc[VTIME] = 0;
-
-	switch (speed) {
-	case 2400:
-		termios.c_cflag |= B2400;
-		break;
-	case 4800:
-		termios.c_cflag |= B4800;
-		break;
-	case 9600:
-		termios.c_cflag |= B9600;
-		break;
-	case 19200:
-		termios.c_cflag |= B19200;
-		break;
-	case 38400:
-		termios.c_cflag |= B38400;
-		break;
-	case 57600:
-		termios.c_cflag |= B57600;
-		break;
-	case 115200:
-		termios.c_cflag |= B115200;
-		break;
-	case 230400:
-		termios.c_cflag |= B230400;
-		break;
-	default:
-		termios.c_cflag |= B9600;
-		break;
+/*
+ * send edev->sending, if the panel doesn't show it already;
+ * stores through mmap() are not tracked, so all of it is compared
+ */
+static int eink_upload(struct eink_dev *edev) {
+	/* 4 lines each time */
+	int each_max = edev->line_len / 8 * 4;
+	unsigned long start;
+	int rc, off, n;
+
+	if (edev->shown_valid && !memcmp(edev->sending, edev->shown, edev->size)) {
+		pr_debug("image unchanged, no refresh\n");
+		return 0;
+	}
+
+	/* header to probe e-ink hardware */
+	rc = eink_send_header(edev);
+	if (rc) {
+		return rc;
 	}
-	eink_tty_ioctl(f, TCSETS, (unsigned long)&termios);
 
-	/* Set low latency */
-	eink_tty_ioctl(f, TIOCGSERIAL, (unsigned long)&serial);
-	serial.flags |= ASYNC_LOW_LATENCY;
-	eink_tty_ioctl(f, TIOCSSERIAL, (unsigned long)&serial);
+	for (off = 0; off < edev->size; off += n) {
+		n = min((int)edev->size - off, each_max);
 
-	/* Clear input buffer */
-	eink_tty_ioctl(f, TCFLSH, TCIOFLUSH);
+		start = jiffies;
+		if ((n = eink_tty_write(edev, edev->sending + off, n)) < 0) {
+			/* half an image on the panel, unknown */
+			edev->shown_valid = false;
+			return n;
+		}
 
-	set_fs(oldfs);
+		/* e-ink slow wrtting */
+		if (handshake && !edev->no_tags) {
+			if (!eink_check_progress(edev, start)) {
+				continue;
+			}
+			pr_info("no progress tags from firmware, fixed delays\n");
+			edev->no_tags = true;
+		}
+		msleep(EINK_LINE_DLY);
+	}
 
+	memcpy(edev->shown, edev->sending, edev->size);
+	edev->shown_valid = true;
 	return 0;
 }
 
-#if EINK_CHK_PROGRESS
-#define LINE_BUF_SZ	20
-#define TIMEOUT_MAX	100
-static int eink_check_progress(struct eink_dev *edev) {
-	static char buf[LINE_BUF_SZ];
-	static int index;
+/* send the submitted images, the last one when several came meanwhile */
+static void eink_upload_work(struct work_struct *work) {
+	struct eink_dev *edev = container_of(work, struct eink_dev, upload_work);
 	int rc;
-	int timeout;
 
-	memset(buf, '\0', sizeof buf);
-	for (timeout = TIMEOUT_MAX; timeout > 0; ) {
-		if ((rc = eink_tty_read(edev->tty, 1)) < 0) {
-			usleep_range(1000, 1000);
-			timeout--;
-			continue;
+	for (;;) {
+		mutex_lock(&edev->buf_lock);
+		if (!edev->submitted) {
+			edev->busy = false;
+			mutex_unlock(&edev->buf_lock);
+			break;
 		}
+		edev->submitted = false;
+		memcpy(edev->sending, edev->image, edev->size);
+		mutex_unlock(&edev->buf_lock);
 
-		#if EINK_TAG_DBG
-		pr_info("R %c x%02X\n", rc, rc);
-		#endif
-
-		if (rc == '\r' || rc == '\n') {
-			if (!strcmp(buf, EINK_TAG_NEXT) ||
-			    !strcmp(buf, EINK_TAG_DONE)) {
-				#if EINK_TAG_DBG
-				pr_info("next or done\n");
-				#endif
-				break;
-			}
-			index = 0;
-			memset(buf, '\0', sizeof buf);
-		} else if (index < LINE_BUF_SZ - 1) {
-			buf[index++] = rc;
-			buf[index] = '\0';
+		rc = eink_upload(edev);
+		if (rc) {
+			pr_info("e-ink upload error = %d\n", rc);
 		}
-	}
-	if (timeout <= 0) {
-		return -ETIMEDOUT;
+		WRITE_ONCE(edev->result, rc);
 	}
 
-	#if EINK_TAG_DBG
-	pr_info("timeout = %d\n", timeout);
-	#endif
+	wake_up_interruptible(&edev->wait);
+	kill_fasync(&edev->fasync, SIGIO, POLL_OUT);
+}
 
-	/* Firmware bug: this time to wait burning flash data */
-	msleep(EINK_LINE_DLY + timeout - TIMEOUT_MAX);
-	return 0;
+static void eink_submit(struct eink_dev *edev) {
+	mutex_lock(&edev->buf_lock);
+	edev->submitted = true;
+	edev->busy = true;
+	mutex_unlock(&edev->buf_lock);
+
+	/* seconds of serial upload, kept off system_wq */
+	queue_work(system_long_wq, &edev->upload_work);
 }
-#endif
 
 static ssize_t eink_write(struct file *f, const char __user *buf,
 			     size_t len, loff_t *f_pos)
 {
 	struct eink_dev *edev = to_eink_dev(f->private_data);
-	/* 4 lines each time */
-	int each_max = edev->line_len / 8 * 4;
-	int rc = 0;
-	int left;
-
-	for (left = len; left > 0; ) {
-		int line = min(left, each_max);
-
-		if ((rc = eink_tty_write(edev->tty, (u8*)buf, line)) < 0) {
-			break;
-		}
-		buf += rc;
-		left -= rc;
+	loff_t pos = *f_pos;
 
-		/* e-ink slow wrtting */
-		#if EINK_CHK_PROGRESS
-		eink_check_progress(edev);
-		#else
-		msleep(EINK_LINE_DLY);
-		#endif
+	if (pos >= edev->size) {
+		return len ? -ENOSPC : 0;
 	}
-	if (len != left) {
-		rc = len - left;
-		edev->bytes_left -= rc;
+	len = min_t(size_t, len, edev->size - pos);
+
+	mutex_lock(&edev->buf_lock);
+	if (copy_from_user(edev->image + pos, buf, len)) {
+		mutex_unlock(&edev->buf_lock);
+		return -EFAULT;
 	}
-	return rc;
+	mutex_unlock(&edev->buf_lock);
+
+	*f_pos = pos + len;
+	return len;
 }
 
-/*
- * header & response protocol
- */
-static int eink_send_header(struct file* tty) {
-	int rc, timeout;
-	u8 header = EINK_HDR;
+static loff_t eink_llseek(struct file *f, loff_t offset, int whence)
+{
+	struct eink_dev *edev = to_eink_dev(f->private_data);
 
-	/* clear receiving buffer, in 1 seconds */
-	timeout = 100;
-	while ((rc = eink_tty_read(tty, 10)) >= 0) {
-		pr_info("recv: 0x%02X\n", rc);
-		if (timeout-- <= 0) {
-			return -EBUSY;
-		}
-	}
+	return fixed_size_llseek(f, offset, whence, edev->size);
+}
 
-	/* it's blocked from now on */
-	eink_tty_block(tty);
+static int eink_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	struct eink_dev *edev = to_eink_dev(f->private_data);
 
-	if ((rc = eink_tty_write(tty, &header, sizeof header)) < 0) {
-		pr_info("write e-ink error = %d\n", rc);
+	/* a private copy would never reach EINK_IOC_SUBMIT */
+	if (!(vma->vm_flags & VM_SHARED))
 		return -EINVAL;
-	}
 
-	if ((rc = eink_tty_read(tty, EINK_TIMEOUT)) < 0) {
-		pr_info("read e-ink error = %d\n", rc);
-		return rc;
-	}
+	return remap_vmalloc_range(vma, edev->image, vma->vm_pgoff);
+}
 
-	if (rc != EINK_HDR_RSP) {
-		pr_info("invalid response = 0x%02x\n", rc);
-		return -ENODEV;
-	}
+static long eink_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct eink_dev *edev = to_eink_dev(f->private_data);
 
-	return 0;
+	switch (cmd) {
+	case EINK_IOC_SUBMIT:
+		eink_submit(edev);
+		return 0;
+	}
+	return -ENOTTY;
 }
 
-static int eink_open(struct inode *inode, struct file *f)
+static unsigned int eink_poll(struct file *f, poll_table *wait)
 {
 	struct eink_dev *edev = to_eink_dev(f->private_data);
-	struct device* dev = edev->miscdev.this_device;
-	int rc = 0;
+	unsigned int mask = 0;
 
-	if (!mutex_trylock(&edev->mutex)) {
-		pr_debug("Device Busy\n");
-		return -EBUSY;
-	}
+	poll_wait(f, &edev->wait, wait);
 
-	edev->tty = filp_open(edev->tty_port, O_RDWR | O_NONBLOCK, 0);
-	if (IS_ERR(edev->tty)) {
-		rc = (int)PTR_ERR(edev->tty);
-		dev_err(dev, "file %s open error = %d\n", edev->tty_port, rc);
-		goto fail;
+	if (!READ_ONCE(edev->busy)) {
+		mask |= POLLOUT | POLLWRNORM;
+		if (READ_ONCE(edev->result)) {
+			mask |= POLLERR;
+		}
 	}
+	return mask;
+}
 
-	/* Set configuration to the tty port */
-	rc = eink_tty_setspeed(edev->tty, edev->baudrate);
-	if (rc) {
-		goto fail;
-	}
+static int eink_fasync(int fd, struct file *f, int on)
+{
+	struct eink_dev *edev = to_eink_dev(f->private_data);
 
-	/* header to probe e-ink hardware */
-	rc = eink_send_header(edev->tty);
+	return fasync_helper(fd, f, on, &edev->fasync);
+}
+
+static int eink_fsync(struct file *f, loff_t start, loff_t end, int datasync)
+{
+	struct eink_dev *edev = to_eink_dev(f->private_data);
+	int rc;
+
+	eink_submit(edev);
+
+	rc = wait_event_interruptible(edev->wait, !READ_ONCE(edev->busy));
 	if (rc) {
-		goto fail;
+		return rc;
 	}
+	return READ_ONCE(edev->result);
+}
 
-	edev->bytes_left = edev->size;
-	return 0;
+static int eink_open(struct inode *inode, struct file *f)
+{
+	struct eink_dev *edev = to_eink_dev(f->private_data);
 
-fail:
-	mutex_unlock(&edev->mutex);
-	return rc;
+	if (!mutex_trylock(&edev->mutex)) {
+		pr_debug("Device Busy\n");
+		return -EBUSY;
+	}
+	return 0;
 }
 
+/* what was written goes to the panel, close() does not wait for it */
 static int eink_release(struct inode *inode, struct file *f)
 {
 	struct eink_dev *edev = to_eink_dev(f->private_data);
-	mutex_unlock(&edev->mutex);
 
-	filp_close(edev->tty, NULL);
+	eink_fasync(-1, f, 0);
+	eink_submit(edev);
 
-	if (edev->bytes_left > 0) {
-		pr_info("incomplete e-ink display data be written\n");
-		return -EINVAL;
-	}
+	mutex_unlock(&edev->mutex);
 	return 0;
 }
 
 static const struct file_operations eink_fops = {
 	.owner		= THIS_MODULE,
 	.write		= eink_write,
+	.llseek		= eink_llseek,
+	.mmap		= eink_mmap,
+	.unlocked_ioctl	= eink_ioctl,
+	.compat_ioctl	= eink_ioctl,
+	.poll		= eink_poll,
+	.fasync		= eink_fasync,
+	.fsync		= eink_fsync,
 	.open		= eink_open,
 	.release	= eink_release
 };
@@ -419,13 +442,14 @@ static const struct file_operations eink_fops = {
 static const struct miscdevice misc_def = {
 	.minor		= MISC_DYNAMIC_MINOR,
 	.name		= "eink",
-	.mode		= S_IWUGO,
+	/* mmap() and poll() need read access */
+	.mode		= S_IRUGO | S_IWUGO,
 	.fops		= &eink_fops
 };
 
-static int eink_probe(struct platform_device *pdev)
+static int eink_probe(struct serdev_device *serdev)
 {
-	struct device_node *np = pdev->dev.of_node;
+	struct device_node *np = serdev->dev.of_node;
 	struct device *dev;
 	struct eink_dev *edev;
 	int rc;
@@ -435,13 +459,9 @@ static int eink_probe(struct platform_device *pdev)
 	if (!edev) {
 		return -ENOMEM;
 	}
-
-	rc = of_property_read_string(np, "tty-port", &edev->tty_port);
-	if (rc) {
-		edev->tty_port = DEFAULT_TTY;
-		pr_err("tty-port property not found, use default %s\n",
-			edev->tty_port);
-	}
+	edev->serdev = serdev;
+	init_completion(&edev->hdr_done);
+	init_completion(&edev->progress);
 
 	rc = of_property_read_u32(np, "baudrate", &edev->baudrate);
 	if (rc) {
@@ -465,10 +485,32 @@ static int eink_probe(struct platform_device *pdev)
 	}
 
 	mutex_init(&edev->mutex);
+	mutex_init(&edev->buf_lock);
+	INIT_WORK(&edev->upload_work, eink_upload_work);
+	init_waitqueue_head(&edev->wait);
 
 	/* 1 pixel occupy 2 bits */
 	edev->size = edev->line_len * edev->num_lines / 4;
 
+	edev->image = vmalloc_user(edev->size);
+	edev->sending = kzalloc(edev->size, GFP_KERNEL);
+	edev->shown = kzalloc(edev->size, GFP_KERNEL);
+	if (!edev->image || !edev->sending || !edev->shown) {
+		rc = -ENOMEM;
+		goto free_eink;
+	}
+
+	/* the port stays open, opening the device costs nothing */
+	serdev_device_set_drvdata(serdev, edev);
+	serdev_device_set_client_ops(serdev, &eink_serdev_ops);
+	rc = serdev_device_open(serdev);
+	if (rc) {
+		pr_err("Failed to open %s = %d\n", dev_name(&serdev->ctrl->dev), rc);
+		goto free_eink;
+	}
+	serdev_device_set_baudrate(serdev, edev->baudrate);
+	serdev_device_set_flow_control(serdev, false);
+
 	pr_devel("E-ink of size %u bytes found with %u lines of length %u\n",
 		edev->size, edev->num_lines, edev->line_len);
 
@@ -478,31 +520,38 @@ static int eink_probe(struct platform_device *pdev)
 	rc = misc_register(&edev->miscdev);
 	if (rc) {
 		pr_err("Failed to register as misc device\n");
-		goto free_eink;
+		goto close_serdev;
 	}
 
-	/* platform device drvdata */
-	dev_set_drvdata(&pdev->dev, edev);
-
 	/* misc device drvdata */
 	dev = edev->miscdev.this_device;
 	dev_set_drvdata(dev, edev);
 
 	return 0;
 
+close_serdev:
+	serdev_device_close(serdev);
 free_eink:
+	vfree(edev->image);
+	kfree(edev->sending);
+	kfree(edev->shown);
 	kfree(edev);
 	return rc;
 }
 
-static int eink_remove(struct platform_device *pdev)
+static void eink_remove(struct serdev_device *serdev)
 {
-	struct eink_dev *edev = platform_get_drvdata(pdev);
-	
+	struct eink_dev *edev = serdev_device_get_drvdata(serdev);
+
 	misc_deregister(&edev->miscdev);
+	/* the last image submitted still goes out */
+	flush_work(&edev->upload_work);
+	serdev_device_close(serdev);
 	kfree(edev->miscdev.name);
+	vfree(edev->image);
+	kfree(edev->sending);
+	kfree(edev->shown);
 	kfree(edev);
-	return 0;
 }
 
 static const struct of_device_id eink_match[] = {
@@ -510,7 +559,7 @@ static const struct of_device_id eink_match[] = {
 	{ },
 };
 
-static struct platform_driver eink_driver = {
+static struct serdev_device_driver eink_driver = {
 	.driver	= {
 		.name		= "eink",
 		.of_match_table	= eink_match,
@@ -519,7 +568,7 @@ static struct platform_driver eink_driver = {
 	.remove	= eink_remove,
 };
 
-module_platform_driver(eink_driver);
+module_serdev_device_driver(eink_driver);
 
 MODULE_DEVICE_TABLE(of, eink_match);
 MODULE_LICENSE("GPL v2");
@@ -286,6 +286,13 @@ void gtp_work_control_enable(struct goodix_ts_data *ts, bool enable)
 {
 	if (enable) {
 		set_bit(REPORT_THREAD_ENABLED, &ts->flags);
+		/* polling stops while disabled, start over at the fast rate */
+		if (test_bit(HRTIMER_USED, &ts->flags)) {
+			ts->poll_ms = GTP_POLL_TIME;
+			ts->idle_polls = 0;
+			hrtimer_start(&ts->timer, ms_to_ktime(ts->poll_ms),
+				      HRTIMER_MODE_REL);
+		}
 		dev_info(&ts->client->dev, "Input report thread enabled!\n");
 	} else {
 		clear_bit(REPORT_THREAD_ENABLED, &ts->flags);
@@ -333,10 +340,80 @@ static int gtp_gesture_handler(struct goodix_ts_data *ts)
 	return 0;
 }
 
+/*
+ * Read status, points and key byte of one frame, and with clear set,
+ * clear the status in the same transfer: address, read, end_cmd.
+ * Only for a buffer known ready, the clear would drop a frame the panel
+ * finished meanwhile. Adapters not taking a write after a read get the
+ * end_cmd on its own.
+ * return: 0 - ok, < 0 - i2c transfer error
+ */
+static int gtp_read_frame(struct goodix_ts_data *ts, u8 *buf, int len,
+			  bool clear)
+{
+	struct i2c_client *client = ts->client;
+	u8 addr_buf[GTP_ADDR_LENGTH] = {
+			GTP_READ_COOR_ADDR >> 8, GTP_READ_COOR_ADDR & 0xFF };
+	u8 end_cmd[3] = { GTP_READ_COOR_ADDR >> 8,
+			  GTP_READ_COOR_ADDR & 0xFF, 0 };
+	struct i2c_msg msgs[] = {
+		{
+			.addr = client->addr,
+			.flags = !I2C_M_RD,
+			.buf = addr_buf,
+			.len = GTP_ADDR_LENGTH,
+		}, {
+			.addr = client->addr,
+			.flags = I2C_M_RD,
+			.buf = buf,
+			.len = len,
+		}, {
+			.addr = client->addr,
+			.flags = !I2C_M_RD,
+			.buf = end_cmd,
+			.len = sizeof(end_cmd),
+		}
+	};
+	int num = clear && !ts->split_end_cmd ? 3 : 2;
+	int retry, ret;
+
+	for (retry = 0; retry < RETRY_MAX_TIMES; retry++) {
+		ret = i2c_transfer(client->adapter, msgs, num);
+		if (likely(ret == num))
+			break;
+		if (ret == -EOPNOTSUPP && num == 3) {
+			dev_info(&client->dev,
+				 "Adapter can't combine end_cmd, sent apart\n");
+			ts->split_end_cmd = true;
+			num = 2;
+			continue;
+		}
+		dev_info(&client->dev, "I2c read retry[%d]:0x%x\n",
+			 retry + 1, GTP_READ_COOR_ADDR);
+		udelay(2000);
+	}
+	if (unlikely(retry == RETRY_MAX_TIMES))
+		return ret < 0 ? ret : -EAGAIN;
+
+	if (clear && num == 2) {
+		ret = gtp_i2c_write(client, end_cmd, 3);
+		if (ret < 0)
+			dev_info(&client->dev, "I2C write end_cmd error!");
+	}
+	return 0;
+}
+
 /*
  * return touch state register value
  * pen event id fixed with 9 and set tool type TOOL_PEN
  *
+ * Points are read as many as the last frame had, plus one for a finger
+ * going down, so a steady touch costs one transfer only.
+ *
+ * With an IRQ the buffer is ready, the status is cleared in the same
+ * transfer, and a frame with more fingers than read is dropped and the
+ * next one read in full. Polling clears apart, only a ready buffer, after
+ * reading the rest of the points.
  */
 u8 gtp_get_points(struct goodix_ts_data *ts, struct goodix_point_t *points,
 		  u8 *key_value)
@@ -346,12 +423,17 @@ u8 gtp_get_points(struct goodix_ts_data *ts, struct goodix_point_t *points,
 	u8 *coor_data = NULL;
 	u8 finger_state = 0;
 	u8 touch_num = 0;
+	u8 read_num;
 	u8 end_cmd[3] = { GTP_READ_COOR_ADDR >> 8,
 			  GTP_READ_COOR_ADDR & 0xFF, 0 };
-	u8 point_data[2 + 1 + 8 * GTP_MAX_TOUCH_ID + 1] = {
-			GTP_READ_COOR_ADDR >> 8, GTP_READ_COOR_ADDR & 0xFF };
-
-	ret = gtp_i2c_read(ts->client, point_data, 12);
+	bool clear = !test_bit(RAW_DATA_MODE, &ts->flags);
+	bool combined = clear && !test_bit(HRTIMER_USED, &ts->flags);
+	/* point_data[0~1] kept free, the layout gtp_i2c_read() leaves */
+	u8 point_data[2 + 1 + 8 * GTP_MAX_TOUCH_ID + 1] = { 0 };
+
+	read_num = min_t(u8, ts->touch_hint + 1, ts->pdata->max_touch_id);
+	ret = gtp_read_frame(ts, &point_data[GTP_ADDR_LENGTH],
+			     1 + 8 * read_num + 1, combined);
 	if (ret < 0) {
 		dev_err(&ts->client->dev,
 			"I2C transfer error. errno:%d\n ", ret);
@@ -359,6 +441,7 @@ u8 gtp_get_points(struct goodix_ts_data *ts, struct goodix_point_t *points,
 	}
 
 	finger_state = point_data[GTP_ADDR_LENGTH];
+	ts->touch_hint = 0;
 	if (finger_state == 0x00)
 		return 0;
 
@@ -370,19 +453,34 @@ u8 gtp_get_points(struct goodix_ts_data *ts, struct goodix_point_t *points,
 		finger_state = 0;
 		goto exit_get_point;
 	}
+	ts->touch_hint = touch_num;
 
-	if (touch_num > 1) {
-		u8 buf[8 * GTP_MAX_TOUCH_ID] = {
-					  (GTP_READ_COOR_ADDR + 10) >> 8,
-					  (GTP_READ_COOR_ADDR + 10) & 0xff };
+	if (touch_num > read_num && combined) {
+		/*
+		 * the status is cleared in the same transfer, the rest of
+		 * the points may be of the next scan by now
+		 */
+		dev_dbg(&ts->client->dev, "%d points, %d read, dropped\n",
+			touch_num, read_num);
+		ts->touch_hint = ts->pdata->max_touch_id;
+		return 0;
+	}
 
-		ret = gtp_i2c_read(ts->client, buf, 2 + 8 * (touch_num - 1));
+	if (touch_num > read_num) {
+		/* not cleared yet, the rest is of the same scan */
+		u8 buf[2 + 8 * GTP_MAX_TOUCH_ID] = {
+			(GTP_READ_COOR_ADDR + 2 + 8 * read_num) >> 8,
+			(GTP_READ_COOR_ADDR + 2 + 8 * read_num) & 0xff };
+
+		ret = gtp_i2c_read(ts->client, buf,
+				   2 + 8 * (touch_num - read_num));
 		if (ret < 0) {
 			dev_err(&ts->client->dev, "I2C error. %d\n", ret);
 			finger_state = 0;
 			goto exit_get_point;
 		}
-		memcpy(&point_data[12], &buf[2], 8 * (touch_num - 1));
+		memcpy(&point_data[4 + 8 * read_num], &buf[2],
+		       8 * (touch_num - read_num));
 	}
 
 	/* panel have touch key */
@@ -430,7 +528,9 @@ u8 gtp_get_points(struct goodix_ts_data *ts, struct goodix_point_t *points,
 	}
 
 exit_get_point:
-	if (!test_bit(RAW_DATA_MODE, &ts->flags)) {
+	/* polling: clear only a buffer seen ready */
+	if (clear && !combined &&
+	    (point_data[GTP_ADDR_LENGTH] & MASK_BIT_8)) {
 		ret = gtp_i2c_write(ts->client, end_cmd, 3);
 		if (ret < 0)
 			dev_info(&ts->client->dev, "I2C write end_cmd error!");
@@ -558,9 +658,9 @@ void gtp_mt_slot_report(struct goodix_ts_data *ts, u8 touch_num,
  * Input:
  *	ts: goodix tp private data
  * Output:
- *	None.
+ *	true if fingers or keys are down.
  *********************************************************/
-static void gtp_work_func(struct goodix_ts_data *ts)
+static bool gtp_work_func(struct goodix_ts_data *ts)
 {
 	u8 point_state = 0;
 	u8 key_value = 0;
@@ -570,9 +670,9 @@ static void gtp_work_func(struct goodix_ts_data *ts)
 	struct goodix_point_t points[GTP_MAX_TOUCH_ID];
 
 	if (test_bit(PANEL_RESETTING, &ts->flags))
-		return;
+		return false;
 	if (!test_bit(REPORT_THREAD_ENABLED, &ts->flags))
-		return;
+		return false;
 
 	/* gesture event */
 	if (ts->pdata->slide_wakeup && test_bit(DOZE_MODE, &ts->flags)) {
@@ -580,13 +680,13 @@ static void gtp_work_func(struct goodix_ts_data *ts)
 		if (ret)
 			dev_err(&ts->client->dev,
 				"Failed handler gesture event %d\n", ret);
-		return;
+		return false;
 	}
 
 	point_state = gtp_get_points(ts, points, &key_value);
 	if (!point_state) {
 		dev_dbg(&ts->client->dev, "Invalid finger points\n");
-		return;
+		return false;
 	}
 
 	/* touch key event */
@@ -628,6 +728,39 @@ static void gtp_work_func(struct goodix_ts_data *ts)
 		gtp_mt_slot_report(ts, point_state & 0x0f, points);
 	else
 		gtp_type_a_report(ts, point_state & 0x0f, points);
+
+	return (point_state & 0x0f) || key_value;
+}
+
+/*******************************************************
+ * Function:
+ *	Polling mode report, I2C may sleep so run from a
+ *	high priority work item. Polls every GTP_POLL_TIME ms
+ *	while touched, backs off to GTP_POLL_IDLE_TIME after
+ *	GTP_POLL_IDLE_COUNT empty polls.
+ * Input:
+ *	work: work struct pointer
+ *********************************************************/
+static void gtp_poll_work_func(struct work_struct *work)
+{
+	struct goodix_ts_data *ts =
+		container_of(work, struct goodix_ts_data, poll_work);
+
+	if (gtp_work_func(ts)) {
+		ts->poll_ms = GTP_POLL_TIME;
+		ts->idle_polls = 0;
+	} else if (ts->idle_polls < GTP_POLL_IDLE_COUNT) {
+		ts->idle_polls++;
+	} else {
+		ts->poll_ms = min_t(unsigned int, ts->poll_ms * 2,
+				    GTP_POLL_IDLE_TIME);
+	}
+
+	/* re-armed by gtp_work_control_enable() */
+	if (test_bit(HRTIMER_USED, &ts->flags) &&
+	    test_bit(REPORT_THREAD_ENABLED, &ts->flags))
+		hrtimer_start(&ts->timer, ms_to_ktime(ts->poll_ms),
+			      HRTIMER_MODE_REL);
 }
 
 /*******************************************************
@@ -645,13 +778,22 @@ static enum hrtimer_restart gtp_timer_handler(struct hrtimer *timer)
 	struct goodix_ts_data *ts =
 		container_of(timer, struct goodix_ts_data, timer);
 
-	gtp_work_func(ts);
-	hrtimer_start(&ts->timer, ktime_set(0, (GTP_POLL_TIME + 6) * 1000000),
-		      HRTIMER_MODE_REL);
+	queue_work(system_highpri_wq, &ts->poll_work);
 
 	return HRTIMER_NORESTART;
 }
 
+static void gtp_poll_stop(struct goodix_ts_data *ts)
+{
+	if (!test_and_clear_bit(HRTIMER_USED, &ts->flags))
+		return;
+
+	/* a running poll may re-arm once more */
+	hrtimer_cancel(&ts->timer);
+	cancel_work_sync(&ts->poll_work);
+	hrtimer_cancel(&ts->timer);
+}
+
 static irqreturn_t gtp_irq_handler(int irq, void *dev_id)
 {
 	struct goodix_ts_data *ts = dev_id;
@@ -1420,12 +1562,13 @@ static int gtp_request_irq(struct goodix_ts_data *ts)
 		}
 	} else { /* use hrtimer */
 		dev_info(&ts->client->dev, "No hardware irq, use hrtimer\n");
+		INIT_WORK(&ts->poll_work, gtp_poll_work_func);
 		hrtimer_init(&ts->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 		ts->timer.function = gtp_timer_handler;
-		hrtimer_start(&ts->timer,
-			      ktime_set(0, (GTP_POLL_TIME + 6) * 1000000),
-			      HRTIMER_MODE_REL);
+		ts->poll_ms = GTP_POLL_TIME;
 		set_bit(HRTIMER_USED, &ts->flags);
+		hrtimer_start(&ts->timer, ms_to_ktime(ts->poll_ms),
+			      HRTIMER_MODE_REL);
 		ret = 0;
 	}
 	return ret;
@@ -1992,6 +2135,7 @@ static int gtp_probe(struct i2c_client *client, const struct i2c_device_id *id)
 
 exit_powermanager:
 	gtp_unregister_powermanager(ts);
+	gtp_poll_stop(ts);
 exit_unreg_input_dev:
 	input_unregister_device(ts->input_dev);
 exit_free_io_port:
@@ -2034,7 +2178,7 @@ static int gtp_drv_remove(struct i2c_client *client)
 	if (ts->client->irq)
 		free_irq(client->irq, ts);
 	else
-		hrtimer_cancel(&ts->timer);
+		gtp_poll_stop(ts);
 
 	if (gpio_is_valid(ts->pdata->rst_gpio))
 		gpio_free(ts->pdata->rst_gpio);
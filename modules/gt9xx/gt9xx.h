@@ -148,6 +148,13 @@ struct goodix_ts_data {
 	/* use pinctrl control int-pin output low or high */
 	struct goodix_pinctrl pinctrl;
 	struct hrtimer timer;
+	struct work_struct poll_work;
+	unsigned int poll_ms;
+	unsigned int idle_polls;
+	/* points read up front, as many as the last frame had */
+	u8 touch_hint;
+	/* adapter takes no write after a read in one transfer */
+	bool split_end_cmd;
 	struct mutex lock;
 	struct notifier_block ps_notif;
 	struct regulator *vdd_ana;
@@ -277,6 +284,8 @@ config your key info here */
 #define GTP_I2C_NAME		"goodix-ts"
 #define GT91XX_CONFIG_PROC_FILE	"gt9xx_config"
 #define GTP_POLL_TIME		10
+#define GTP_POLL_IDLE_TIME	80
+#define GTP_POLL_IDLE_COUNT	30
 #define GTP_CONFIG_MIN_LENGTH	186
 #define GTP_ESD_CHECK_VALUE	0xAA
 #define RETRY_MAX_TIMES		5
@@ -1,7 +1,10 @@
 #include <linux/cdev.h>
 #include <linux/i2c.h>
 #include <linux/delay.h>
+#include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include "hd44780.h"
 
@@ -68,7 +71,7 @@ struct hd44780_geometry *hd44780_geometries[] = {
 /* Defines possible register that we can write to */
 typedef enum { IR, DR } dest_reg;
 
-static void hd44780_write_nibble(struct hd44780 *lcd, dest_reg reg, u8 data)
+static int hd44780_write_nibble(struct hd44780 *lcd, dest_reg reg, u8 data)
 {
 	u8 first;
 
@@ -77,70 +80,216 @@ static void hd44780_write_nibble(struct hd44780 *lcd, dest_reg reg, u8 data)
 	 * Second byte, DATA or CMD
 	 */
 	first = (reg == DR)? _DATA: _CMD;
-	i2c_smbus_write_byte_data(lcd->i2c_client, first, data);
-
-	return;
+	return i2c_smbus_write_byte_data(lcd->i2c_client, first, data);
 }
 
 /*
  * JHD1802 lowlevel functions
  */
-static void hd44780_write_instruction(struct hd44780 *lcd, u8 data)
+static int hd44780_write_instruction(struct hd44780 *lcd, u8 data)
 {
-	hd44780_write_nibble(lcd, IR, data);
-	udelay(37);
+	int ret;
+
+	ret = hd44780_write_nibble(lcd, IR, data);
+	usleep_range(37, 50);
+	return ret;
 }
 
-static void hd44780_write_data(struct hd44780 *lcd, u8 data)
+static int hd44780_write_data(struct hd44780 *lcd, u8 data)
 {
-	hd44780_write_nibble(lcd, DR, data);
-	udelay(37 + 4);
+	int ret;
+
+	ret = hd44780_write_nibble(lcd, DR, data);
+	usleep_range(37 + 4, 50);
+	return ret;
+}
+
+/*
+ * Shadow DDRAM
+ *
+ * Writes only update lcd->fb, under lcd->lock, and return. sync_work
+ * takes a snapshot of it and sends the cells which differ from
+ * lcd->ddram, a run of them in one I2C block write with the address
+ * counter incrementing. Short gaps of unchanged cells are sent along,
+ * that is cheaper than a new address.
+ *
+ * The work runs at most once every frame_ms, whatever is written in
+ * between ends up in one update.
+ *
+ * A failed write leaves lcd->ddram as it was and the address counter
+ * unknown (-1), the cells are sent again on the next update.
+ */
+#define DIFF_GAP	2
+
+static unsigned int frame_ms = 20;
+module_param(frame_ms, uint, 0644);
+MODULE_PARM_DESC(frame_ms, "Shortest interval between two display updates, ms");
+
+static int hd44780_set_addr(struct hd44780 *lcd, int addr)
+{
+	int ret;
+
+	if (lcd->addr == addr)
+		return 0;
+
+	ret = hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR | addr);
+	lcd->addr = ret < 0 ? -1 : addr;
+	return ret;
+}
+
+static int hd44780_write_run(struct hd44780 *lcd, int addr, const char *s, int n)
+{
+	int i, ret;
+
+	ret = hd44780_set_addr(lcd, addr);
+	if (ret < 0)
+		return ret;
+
+	if (lcd->block_write) {
+		/*
+		 * A byte takes 90 us on a 100 kHz bus, longer than the
+		 * controller needs for one, only the last one is waited for.
+		 */
+		ret = i2c_smbus_write_i2c_block_data(lcd->i2c_client, _DATA, n, (const u8 *)s);
+		usleep_range(37 + 4, 50);
+	} else {
+		for (i = 0; i < n && ret >= 0; i++)
+			ret = hd44780_write_data(lcd, s[i]);
+	}
+
+	if (ret < 0) {
+		lcd->addr = -1;
+		return ret;
+	}
+
+	memcpy(&lcd->ddram[addr], s, n);
+	lcd->addr = addr + n;
+	return 0;
+}
+
+static void hd44780_send(struct hd44780 *lcd)
+{
+	struct hd44780_geometry *geo = lcd->geometry;
+	const char *fb, *ddram;
+	int row, col, start, end;
+
+	for (row = 0; row < geo->rows; row++) {
+		fb = lcd->out.fb[row];
+		ddram = &lcd->ddram[geo->start_addrs[row]];
+
+		for (col = 0; col < geo->cols; ) {
+			if (fb[col] == ddram[col]) {
+				col++;
+				continue;
+			}
+
+			start = col;
+			end = col + 1;
+			for (col = end; col < geo->cols && col - end <= DIFF_GAP; col++) {
+				if (fb[col] != ddram[col])
+					end = col + 1;
+			}
+
+			if (hd44780_write_run(lcd, geo->start_addrs[row] + start,
+					&fb[start], end - start) < 0)
+				dev_warn_ratelimited(&lcd->i2c_client->dev,
+					"write failed, cells resent next update\n");
+			col = end;
+		}
+	}
+
+	/* Leave the cursor where the next character goes */
+	hd44780_set_addr(lcd, geo->start_addrs[lcd->out.row] + lcd->out.col);
+}
+
+void hd44780_sync_work(struct work_struct *work)
+{
+	struct hd44780 *lcd = container_of(to_delayed_work(work),
+		struct hd44780, sync_work);
+
+	mutex_lock(&lcd->hw_lock);
+
+	mutex_lock(&lcd->lock);
+	memcpy(lcd->out.fb, lcd->fb, sizeof(lcd->out.fb));
+	lcd->out.row = lcd->pos.row;
+	lcd->out.col = lcd->pos.col;
+	mutex_unlock(&lcd->lock);
+
+	hd44780_send(lcd);
+	WRITE_ONCE(lcd->next_sync, jiffies + msecs_to_jiffies(frame_ms));
+
+	mutex_unlock(&lcd->hw_lock);
+}
+
+/* Get the last writes onto the display, within the frame interval */
+static void hd44780_kick(struct hd44780 *lcd)
+{
+	long delay = (long)(READ_ONCE(lcd->next_sync) - jiffies);
+
+	/* Already pending: this write goes out with it */
+	schedule_delayed_work(&lcd->sync_work, delay > 0 ? delay : 0);
+}
+
+/* Wait until what has been written is on the display */
+void hd44780_sync(struct hd44780 *lcd)
+{
+	flush_delayed_work(&lcd->sync_work);
 }
 
 static void hd44780_write_char(struct hd44780 *lcd, char ch)
 {
 	struct hd44780_geometry *geo = lcd->geometry;
 
-	hd44780_write_data(lcd, ch);
+	lcd->fb[lcd->pos.row][lcd->pos.col] = ch;
 
 	lcd->pos.col++;
 
 	if (lcd->pos.col == geo->cols) {
 		lcd->pos.row = (lcd->pos.row + 1) % geo->rows;
 		lcd->pos.col = 0;
-		hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR | geo->start_addrs[lcd->pos.row]);
 	}
 }
 
-static void hd44780_clear_display(struct hd44780 *lcd)
+/* The controller side of a clear, under hw_lock */
+static void hd44780_clear_ddram(struct hd44780 *lcd)
 {
-	hd44780_write_instruction(lcd, HD44780_CLEAR_DISPLAY);
+	int ret;
+
+	ret = hd44780_write_instruction(lcd, HD44780_CLEAR_DISPLAY);
 
 	/* Wait for 1.64 ms because this one needs more time */
-	udelay(1640);
+	usleep_range(1640, 2000);
 
 	/*
-	 * CLEAR_DISPLAY instruction also returns cursor to home,
-	 * so we need to update it locally.
+	 * CLEAR_DISPLAY instruction fills DDRAM with spaces and also
+	 * returns cursor to home, so we need to update it locally.
+	 * If it failed the spaces go out with the next update.
 	 */
+	if (ret < 0) {
+		lcd->addr = -1;
+	} else {
+		memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+		lcd->addr = 0;
+	}
+}
+
+/* The writers' side of a clear, under lock */
+static void hd44780_clear_fb(struct hd44780 *lcd)
+{
+	memset(lcd->fb, ' ', sizeof(lcd->fb));
 	lcd->pos.row = 0;
 	lcd->pos.col = 0;
 }
 
-static void hd44780_clear_line(struct hd44780 *lcd)
+static void hd44780_clear_display(struct hd44780 *lcd)
 {
-	struct hd44780_geometry *geo;
-	int start_addr, col;
-
-	geo = lcd->geometry;
-	start_addr = geo->start_addrs[lcd->pos.row];
-
-	hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR | start_addr);
-
-	for (col = 0; col < geo->cols; col++)
-		hd44780_write_data(lcd, ' ');
+	hd44780_clear_ddram(lcd);
+	hd44780_clear_fb(lcd);
+}
 
-	hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR | start_addr);
+static void hd44780_clear_line(struct hd44780 *lcd)
+{
+	memset(lcd->fb[lcd->pos.row], ' ', MAX_COLS);
 }
 
 static void hd44780_handle_new_line(struct hd44780 *lcd)
@@ -149,18 +298,12 @@ static void hd44780_handle_new_line(struct hd44780 *lcd)
 
 	lcd->pos.row = (lcd->pos.row + 1) % geo->rows;
 	lcd->pos.col = 0;
-	hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR
-		| geo->start_addrs[lcd->pos.row]);
 	hd44780_clear_line(lcd);
 }
 
 static void hd44780_handle_carriage_return(struct hd44780 *lcd)
 {
-	struct hd44780_geometry *geo = lcd->geometry;
-
 	lcd->pos.col = 0;
-	hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR
-		| geo->start_addrs[lcd->pos.row]);
 }
 
 static void hd44780_leave_esc_seq(struct hd44780 *lcd)
@@ -170,6 +313,8 @@ static void hd44780_leave_esc_seq(struct hd44780 *lcd)
 	lcd->is_in_esc_seq = false;
 }
 
+static void __hd44780_write(struct hd44780 *lcd, const char *buf, size_t count);
+
 static void hd44780_flush_esc_seq(struct hd44780 *lcd)
 {
 	char *buf_to_flush;
@@ -186,7 +331,7 @@ static void hd44780_flush_esc_seq(struct hd44780 *lcd)
 	hd44780_write_char(lcd, '\e');
 
 	/* Flush current esc seq */
-	hd44780_write(lcd, buf_to_flush, buf_length);
+	__hd44780_write(lcd, buf_to_flush, buf_length);
 
 	kfree(buf_to_flush);
 }
@@ -195,24 +340,20 @@ void hd44780_flush(struct hd44780 *lcd)
 {
 	while (lcd->is_in_esc_seq)
 		hd44780_flush_esc_seq(lcd);
+
+	hd44780_kick(lcd);
 }
 
 static void hd44780_handle_esc_seq_char(struct hd44780 *lcd, char ch)
 {
-	int prev_row, prev_col;
-
 	lcd->esc_seq_buf.buf[lcd->esc_seq_buf.length++] = ch;
 
 	if (!strcmp(lcd->esc_seq_buf.buf, "[2J")) {
-		prev_row = lcd->pos.row;
-		prev_col = lcd->pos.col;
-
-		hd44780_clear_display(lcd);
-		hd44780_write_instruction(lcd, HD44780_DDRAM_ADDR | (lcd->geometry->start_addrs[prev_row] + prev_col));
+		/* Cursor stays where it was */
+		memset(lcd->fb, ' ', sizeof(lcd->fb));
 
 		hd44780_leave_esc_seq(lcd);
 	} else if (!strcmp(lcd->esc_seq_buf.buf, "[H")) {
-		hd44780_write_instruction(lcd, HD44780_RETURN_HOME);
 		lcd->pos.row = 0;
 		lcd->pos.col = 0;
 
@@ -222,13 +363,15 @@ static void hd44780_handle_esc_seq_char(struct hd44780 *lcd, char ch)
 	}
 }
 
-void hd44780_write(struct hd44780 *lcd, const char *buf, size_t count)
+static void __hd44780_write(struct hd44780 *lcd, const char *buf, size_t count)
 {
 	size_t i;
 	char ch;
 
 	if (lcd->dirty) {
-		hd44780_clear_display(lcd);
+		memset(lcd->fb, ' ', sizeof(lcd->fb));
+		lcd->pos.row = 0;
+		lcd->pos.col = 0;
 		lcd->dirty = false;
 	}
 
@@ -256,19 +399,44 @@ void hd44780_write(struct hd44780 *lcd, const char *buf, size_t count)
 	}
 }
 
+void hd44780_write(struct hd44780 *lcd, const char *buf, size_t count)
+{
+	__hd44780_write(lcd, buf, count);
+	hd44780_kick(lcd);
+}
+
+/* Take the whole screen from the mmap()ed cells */
+void hd44780_load_cells(struct hd44780 *lcd)
+{
+	struct hd44780_geometry *geo = lcd->geometry;
+	const char *cells = page_address(lcd->cells);
+	int row;
+
+	for (row = 0; row < geo->rows; row++)
+		memcpy(lcd->fb[row], cells + row * MAX_COLS, geo->cols);
+
+	lcd->dirty = false;
+	hd44780_kick(lcd);
+}
+
 void hd44780_print(struct hd44780 *lcd, const char *str)
 {
 	hd44780_write(lcd, str, strlen(str));
 }
 
+/* Called with hw_lock held, writers only wait for the state change */
 void hd44780_set_geometry(struct hd44780 *lcd, struct hd44780_geometry *geo)
 {
+	mutex_lock(&lcd->lock);
 	lcd->geometry = geo;
 
 	if (lcd->is_in_esc_seq)
 		hd44780_leave_esc_seq(lcd);
 
-	hd44780_clear_display(lcd);
+	hd44780_clear_fb(lcd);
+	mutex_unlock(&lcd->lock);
+
+	hd44780_clear_ddram(lcd);
 }
 
 void hd44780_set_backlight(struct hd44780 *lcd, bool backlight)
@@ -308,11 +476,11 @@ void hd44780_init_lcd(struct hd44780 *lcd)
 	 *   the Hitachi HD44780 datasheet */
 	hd44780_write_instruction(lcd, HD44780_FUNCTION_SET
 		| HD44780_DL_8BITS);
-	mdelay(5);
+	usleep_range(5000, 6000);
 
 	hd44780_write_instruction(lcd, HD44780_FUNCTION_SET
 		| HD44780_DL_8BITS);
-	udelay(100);
+	usleep_range(100, 150);
 
 	hd44780_write_instruction(lcd, HD44780_FUNCTION_SET
 		| HD44780_DL_8BITS);
@@ -322,7 +490,7 @@ void hd44780_init_lcd(struct hd44780 *lcd)
 
 	hd44780_write_instruction(lcd, HD44780_DISPLAY_CTRL | HD44780_D_DISPLAY_ON
 		| HD44780_C_CURSOR_ON | HD44780_B_BLINK_ON);
-	udelay(100);
+	usleep_range(100, 150);
 
 	hd44780_clear_display(lcd);
 
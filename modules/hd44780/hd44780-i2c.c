@@ -32,8 +32,11 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
 
 #include "hd44780.h"
+#include "hd44780-ioctl.h"
 
 #define CLASS_NAME	"hd44780"
 #define NAME		"seeed-hd44780"
@@ -76,9 +79,9 @@ static ssize_t geometry_store(struct device *dev,
 		if (geo->cols == cols && geo->rows == rows) {
 			lcd = dev_get_drvdata(dev);
 
-			mutex_lock(&lcd->lock);
+			mutex_lock(&lcd->hw_lock);
 			hd44780_set_geometry(lcd, geo);
-			mutex_unlock(&lcd->lock);
+			mutex_unlock(&lcd->hw_lock);
 
 			break;
 		}
@@ -101,9 +104,9 @@ static ssize_t backlight_store(struct device *dev,
 {
 	struct hd44780 *lcd = dev_get_drvdata(dev);
 
-	mutex_lock(&lcd->lock);
+	mutex_lock(&lcd->hw_lock);
 	hd44780_set_backlight(lcd, buf[0] == '1');
-	mutex_unlock(&lcd->lock);
+	mutex_unlock(&lcd->hw_lock);
 
 	return count;
 }
@@ -122,9 +125,9 @@ static ssize_t cursor_blink_store(struct device *dev,
 {
 	struct hd44780 *lcd = dev_get_drvdata(dev);
 
-	mutex_lock(&lcd->lock);
+	mutex_lock(&lcd->hw_lock);
 	hd44780_set_cursor_blink(lcd, buf[0] == '1');
-	mutex_unlock(&lcd->lock);
+	mutex_unlock(&lcd->hw_lock);
 
 	return count;
 }
@@ -143,9 +146,9 @@ static ssize_t cursor_display_store(struct device *dev,
 {
 	struct hd44780 *lcd = dev_get_drvdata(dev);
 
-	mutex_lock(&lcd->lock);
+	mutex_lock(&lcd->hw_lock);
 	hd44780_set_cursor_display(lcd, buf[0] == '1');
-	mutex_unlock(&lcd->lock);
+	mutex_unlock(&lcd->hw_lock);
 
 	return count;
 }
@@ -171,32 +174,94 @@ static int hd44780_file_open(struct inode *inode, struct file *filp)
 static int hd44780_file_release(struct inode *inode, struct file *filp)
 {
 	struct hd44780 *lcd = filp->private_data;
+
+	mutex_lock(&lcd->lock);
 	hd44780_flush(lcd);
+	mutex_unlock(&lcd->lock);
 	return 0;
 }
 
+static int hd44780_file_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+	struct hd44780 *lcd = filp->private_data;
+
+	hd44780_sync(lcd);
+	return 0;
+}
+
+/*
+ * Only updates the screen buffer, the display follows from sync_work,
+ * fsync() waits for it.
+ */
 static ssize_t hd44780_file_write(struct file *filp, const char __user *buf, size_t count, loff_t *offp)
 {
 	struct hd44780 *lcd;
-	size_t n;
+	size_t done, n;
 
 	lcd = filp->private_data;
-	n = min(count, (size_t)BUF_SIZE);
 
-	// TODO: Consider using an interruptible lock
-	mutex_lock(&lcd->lock);
+	if (mutex_lock_interruptible(&lcd->lock))
+		return -ERESTARTSYS;
+
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, (size_t)BUF_SIZE);
+
+		if (copy_from_user(lcd->buf, buf + done, n)) {
+			mutex_unlock(&lcd->lock);
+			return done ? done : -EFAULT;
+		}
 
-	// TODO: Support partial writes during errors?
-	if (copy_from_user(lcd->buf, buf, n)) {
+		hd44780_write(lcd, lcd->buf, n);
+	}
+
+	mutex_unlock(&lcd->lock);
+
+	return count;
+}
+
+static long hd44780_file_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct hd44780 *lcd = filp->private_data;
+	struct hd44780_info info;
+
+	switch (cmd) {
+	case HD44780_IOC_INFO:
+		mutex_lock(&lcd->lock);
+		info.cols = lcd->geometry->cols;
+		info.rows = lcd->geometry->rows;
+		mutex_unlock(&lcd->lock);
+		info.stride = MAX_COLS;
+		info.size = PAGE_SIZE;
+
+		if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+			return -EFAULT;
+		return 0;
+
+	case HD44780_IOC_FLUSH:
+		if (mutex_lock_interruptible(&lcd->lock))
+			return -ERESTARTSYS;
+		hd44780_load_cells(lcd);
 		mutex_unlock(&lcd->lock);
-		return -EFAULT;
+
+		if (arg & HD44780_FLUSH_WAIT)
+			hd44780_sync(lcd);
+		return 0;
 	}
 
-	hd44780_write(lcd, lcd->buf, n);
+	return -ENOTTY;
+}
 
-	mutex_unlock(&lcd->lock);
+static int hd44780_file_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct hd44780 *lcd = filp->private_data;
+
+	/* a private copy would never reach HD44780_IOC_FLUSH */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+		return -EINVAL;
 
-	return n;
+	return vm_insert_page(vma, vma->vm_start, lcd->cells);
 }
 
 static void hd44780_init(struct hd44780 *lcd, struct hd44780_geometry *geometry,
@@ -212,13 +277,25 @@ static void hd44780_init(struct hd44780 *lcd, struct hd44780_geometry *geometry,
 	lcd->backlight = true;
 	lcd->cursor_blink = true;
 	lcd->cursor_display = true;
+	memset(lcd->fb, ' ', sizeof(lcd->fb));
+	memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+	lcd->addr = -1;
+	lcd->block_write = i2c_check_functionality(i2c_client->adapter,
+		I2C_FUNC_SMBUS_WRITE_I2C_BLOCK);
+	INIT_DELAYED_WORK(&lcd->sync_work, hd44780_sync_work);
+	lcd->next_sync = jiffies;
 	mutex_init(&lcd->lock);
+	mutex_init(&lcd->hw_lock);
 }
 
 static struct file_operations fops = {
 	.open = hd44780_file_open,
 	.release = hd44780_file_release,
 	.write = hd44780_file_write,
+	.fsync = hd44780_file_fsync,
+	.unlocked_ioctl = hd44780_file_ioctl,
+	.compat_ioctl = hd44780_file_ioctl,
+	.mmap = hd44780_file_mmap,
 };
 
 static int hd44780_probe(struct i2c_client *client, const struct i2c_device_id *id)
@@ -236,6 +313,13 @@ static int hd44780_probe(struct i2c_client *client, const struct i2c_device_id *
 		return -ENOMEM;
 	}
 
+	lcd->cells = alloc_page(GFP_KERNEL);
+	if (!lcd->cells) {
+		kfree(lcd);
+		return -ENOMEM;
+	}
+	memset(page_address(lcd->cells), ' ', PAGE_SIZE);
+
 	/* JHD1802, default resolution 16x2 */
 	hd44780_init(lcd, hd44780_geometries[1], client);
 
@@ -276,6 +360,7 @@ del_exit:
 	list_del(&lcd->list);
 	spin_unlock(&hd44780_list_lock);
 exit:
+	__free_page(lcd->cells);
 	kfree(lcd);
 
 	return ret;
@@ -304,11 +389,14 @@ static int hd44780_remove(struct i2c_client *client)
 	lcd = get_hd44780_by_i2c_client(client);
 	device_destroy(hd44780_class, lcd->device->devt);
 	cdev_del(&lcd->cdev);
+	cancel_delayed_work_sync(&lcd->sync_work);
 
 	spin_lock(&hd44780_list_lock);
 	list_del(&lcd->list);
 	spin_unlock(&hd44780_list_lock);
 
+	/* Mappings still around keep their own reference */
+	__free_page(lcd->cells);
 	kfree(lcd);
 	
 	return 0;
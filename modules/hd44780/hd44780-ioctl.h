@@ -0,0 +1,29 @@
+#ifndef _HD44780_IOCTL_H_
+#define _HD44780_IOCTL_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * Cell buffer interface of /dev/lcdN
+ *
+ * mmap() the device, offset 0, info.size bytes: cell (row, col) is the
+ * byte at row * info.stride + col. Change cells in place, then
+ * HD44780_IOC_FLUSH puts them on the display, only the changed ones are
+ * sent. Escape sequences are not parsed, bytes go to the DDRAM as is.
+ */
+struct hd44780_info {
+	__u32 cols;
+	__u32 rows;
+	__u32 stride;		/* bytes from one row to the next */
+	__u32 size;		/* of the mapping */
+};
+
+/* HD44780_IOC_FLUSH argument */
+#define HD44780_FLUSH_WAIT	0x01	/* return once the display shows it */
+
+#define HD44780_IOC_MAGIC	'j'
+#define HD44780_IOC_INFO	_IOR(HD44780_IOC_MAGIC, 0, struct hd44780_info)
+#define HD44780_IOC_FLUSH	_IO(HD44780_IOC_MAGIC, 1)
+
+#endif
@@ -4,6 +4,11 @@
 #define BUF_SIZE		64
 #define ESC_SEQ_BUF_SIZE	4
 
+/* Largest of hd44780_geometries, and the DDRAM address space */
+#define MAX_ROWS		4
+#define MAX_COLS		20
+#define DDRAM_SIZE		0x80
+
 struct hd44780_geometry {
 	int cols;
 	int rows;
@@ -35,7 +40,30 @@ struct hd44780 {
 
 	bool dirty;
 
+	/*
+	 * Screen as written so far, and what the DDRAM holds.
+	 * sync_work sends the difference, at most once a frame.
+	 */
+	char fb[MAX_ROWS][MAX_COLS];
+	char ddram[DDRAM_SIZE];
+	int addr;		/* DDRAM address counter, -1 unknown */
+	bool block_write;	/* adapter does I2C block writes */
+
+	/* Snapshot of fb and pos being sent */
+	struct {
+		char fb[MAX_ROWS][MAX_COLS];
+		int row;
+		int col;
+	} out;
+	struct delayed_work sync_work;
+	unsigned long next_sync;	/* jiffies, earliest next frame */
+
+	/* mmap()ed cells, rows of MAX_COLS, see hd44780-ioctl.h */
+	struct page *cells;
+
+	/* lock: writers' state; hw_lock: the controller, taken first */
 	struct mutex lock;
+	struct mutex hw_lock;
 	struct list_head list;
 };
 
@@ -43,6 +71,9 @@ void hd44780_write(struct hd44780 *, const char *, size_t);
 void hd44780_init_lcd(struct hd44780 *);
 void hd44780_print(struct hd44780 *, const char *);
 void hd44780_flush(struct hd44780 *);
+void hd44780_sync(struct hd44780 *);
+void hd44780_sync_work(struct work_struct *);
+void hd44780_load_cells(struct hd44780 *);
 void hd44780_set_geometry(struct hd44780 *, struct hd44780_geometry *);
 void hd44780_set_backlight(struct hd44780 *, bool);
 void hd44780_set_cursor_blink(struct hd44780 *, bool);
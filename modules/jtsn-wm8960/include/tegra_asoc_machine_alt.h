@@ -69,6 +69,8 @@ struct tegra_machine {
 	unsigned int num_codec_links;
 	int rate_via_kcontrol;
 	int fmt_via_kcontrol;
+	/* appended, the tegra-alt utils only know the fields above */
+	unsigned int *codec_tdm_mask;	/* per codec link, 0 if not set */
 };
 
 extern struct snd_soc_dai_link tegra186_xbar_dai_links[];
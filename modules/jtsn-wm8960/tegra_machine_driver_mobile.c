@@ -28,7 +28,7 @@
 #include <sound/pcm_params.h>
 #include <sound/soc.h>
 #include <dt-bindings/sound/tas2552.h>
-#include "wm8960.h"
+#include "../seeed-voicecard/wm8960.h"
 #include "tegra_asoc_machine_alt.h"
 #include "tegra210_xbar_alt.h"
 
@@ -252,17 +252,26 @@ static int tegra_machine_set_params(struct snd_soc_card *card,
 
 			if ((idx >= machine->soc_data->num_ahub_links)
 				&& (idx < num_of_dai_links)) {
+				unsigned int *tdm_mask = NULL;
 				unsigned int fmt;
 
-				/* TODO: why below overrite is needed */
+				/*
+				 * Codec links carry the stream format as is,
+				 * the kcontrol S32 only widens the AHUB path.
+				 */
 				dai_params->formats = formats;
 
+				if (machine->codec_tdm_mask)
+					tdm_mask = &machine->codec_tdm_mask[
+					  idx - machine->soc_data->num_ahub_links];
+
 				fmt = rtd->dai_link->dai_fmt;
 				fmt &= SND_SOC_DAIFMT_FORMAT_MASK;
 
-				/* set TDM slot mask */
-				if (fmt == SND_SOC_DAIFMT_DSP_A ||
-				    fmt == SND_SOC_DAIFMT_DSP_B) {
+				/* set TDM slot mask, once per change */
+				if ((fmt == SND_SOC_DAIFMT_DSP_A ||
+				     fmt == SND_SOC_DAIFMT_DSP_B) &&
+				    (!tdm_mask || *tdm_mask != mask)) {
 					err = snd_soc_dai_set_tdm_slot(
 							rtd->cpu_dai, mask,
 							mask, 0, 0);
@@ -272,6 +281,8 @@ static int tegra_machine_set_params(struct snd_soc_card *card,
 						rtd->cpu_dai->name);
 						return err;
 					}
+					if (tdm_mask)
+						*tdm_mask = mask;
 				}
 			}
 		}
@@ -437,6 +448,7 @@ static void tegra_machine_pcm_shutdown(struct snd_pcm_substream *substream)
 
 static int tegra_machine_suspend_pre(struct snd_soc_card *card)
 {
+	struct tegra_machine *machine = snd_soc_card_get_drvdata(card);
 	struct snd_soc_pcm_runtime *rtd;
 
 	/* DAPM dai link stream work for non pcm links */
@@ -445,6 +457,11 @@ static int tegra_machine_suspend_pre(struct snd_soc_card *card)
 			INIT_DELAYED_WORK(&rtd->delayed_work, NULL);
 	}
 
+	/* set the slot masks again after resume */
+	if (machine->codec_tdm_mask)
+		memset(machine->codec_tdm_mask, 0, machine->num_codec_links *
+		       sizeof(*machine->codec_tdm_mask));
+
 	return 0;
 }
 
@@ -698,6 +715,15 @@ static int tegra_machine_driver_probe(struct platform_device *pdev)
 	if (ret < 0)
 		goto cleanup_asoc;
 
+	machine->codec_tdm_mask = devm_kcalloc(&pdev->dev,
+					       machine->num_codec_links,
+					       sizeof(*machine->codec_tdm_mask),
+					       GFP_KERNEL);
+	if (machine->num_codec_links && !machine->codec_tdm_mask) {
+		ret = -ENOMEM;
+		goto cleanup_asoc;
+	}
+
 	ret = tegra_alt_asoc_utils_init(&machine->audio_clock,
 					&pdev->dev,
 					card);
@@ -0,0 +1,27 @@
+/*
+ * Chainable RGB LED (P9813) binary interface
+ *
+ * Copyright (C) 2019 Seeed Studio
+ *
+ * Released under the GPLv2
+ *
+ * mmap() /dev/p981xN, offset 0, P981X_MAP_SIZE bytes: LED i is the 3
+ * bytes red, green, blue at 3 * i. Set the chain length once with
+ * P981X_IOC_SET_COUNT, change the colors in place and send them all in
+ * one frame with P981X_IOC_COMMIT.
+ */
+#ifndef _P9813_IOCTL_H_
+#define _P9813_IOCTL_H_
+
+#include <linux/ioctl.h>
+
+#define P981X_LEDS_MAX		1024
+#define P981X_MAP_SIZE		4096	/* page, P981X_LEDS_MAX * 3 used */
+
+#define P981X_IOC_MAGIC		'p'
+/* argument: LEDs in the chain, 0 to P981X_LEDS_MAX */
+#define P981X_IOC_SET_COUNT	_IO(P981X_IOC_MAGIC, 0)
+/* no argument */
+#define P981X_IOC_COMMIT	_IO(P981X_IOC_MAGIC, 1)
+
+#endif
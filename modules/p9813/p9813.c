@@ -26,17 +26,28 @@
 #include <linux/of.h>
 #include <linux/of_gpio.h>
 #include <linux/of_device.h>
+#include <linux/spi/spi.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+
+#include "p9813-ioctl.h"
 
 #define DEV_NAME "p981x"
 
 /* FCLK <= 15MHz */
 #define P981X_PULSE_DLY		50    /* ns */
+#define P981X_SPI_HZ_MAX	15000000
 
 #define P981X_LINE_LEN		64   /* chars */
+#define P981X_WRITE_CHUNK	256  /* bytes copied from user at once */
 
 /*
  * This driver creates a character device (/dev/p981xN) which exposes the
  * Chainable RGB LED (P9813)
+ *
+ * The chain hangs off two GPIOs (platform device, bit-banged) or off the
+ * SCLK and MOSI lines of an SPI controller (spi device, the whole frame
+ * goes out in one transfer, DMA if the controller does it).
  */
 
 struct p981x_dev {
@@ -47,6 +58,11 @@ struct p981x_dev {
 	int     pin_clk;
 	int     pin_data;
 
+	/* or SPI */
+	struct spi_device *spi;
+	/* SPI frame, prefix and suffix words included */
+	__be32* frame;
+
 	/* locks */
 	struct mutex mutex;
 
@@ -54,6 +70,8 @@ struct p981x_dev {
 	int	count;
 	/* LEDs data buffer */
 	u32*    buffer;
+	/* mmap()ed RGB, see p9813-ioctl.h */
+	struct page* rgb;
 
 	/* command line index */
 	int     index;
@@ -90,9 +108,29 @@ static int p981x_send_u32(struct p981x_dev *ppd, u32 word) {
 	return 0;
 }
 
+static int p981x_spi_send_frame(struct p981x_dev *ppd) {
+	int i;
+
+	if (!ppd->frame || !ppd->buffer) {
+		return 0;
+	}
+
+	ppd->frame[0] = 0;
+	for (i = 0; i < ppd->count; i++) {
+		ppd->frame[i + 1] = cpu_to_be32(ppd->buffer[i]);
+	}
+	ppd->frame[ppd->count + 1] = 0;
+
+	return spi_write(ppd->spi, ppd->frame, (ppd->count + 2) * sizeof(__be32));
+}
+
 static int p981x_send_frame(struct p981x_dev *ppd) {
 	int i;
 
+	if (ppd->spi) {
+		return p981x_spi_send_frame(ppd);
+	}
+
 	/* Send data frame prefix (32x "0") */
 	p981x_send_u32(ppd, 0x0UL);
 
@@ -119,6 +157,28 @@ static u32 p981x_color(u8 red, u8 green, u8 blue) {
 	return color;
 }
 
+static int p981x_set_count(struct p981x_dev *ppd, int count) {
+	ppd->count = count;
+	if (ppd->buffer) {
+		kfree(ppd->buffer);
+		ppd->buffer = NULL;
+	}
+	if (ppd->frame) {
+		kfree(ppd->frame);
+		ppd->frame = NULL;
+	}
+	if (ppd->count > 0) {
+		ppd->buffer = kmalloc(sizeof(u32) * ppd->count, GFP_KERNEL);
+	}
+	if (ppd->count > 0 && ppd->spi) {
+		ppd->frame = kmalloc(sizeof(__be32) * (ppd->count + 2), GFP_KERNEL);
+	}
+	if (ppd->count > 0 && (!ppd->buffer || (ppd->spi && !ppd->frame))) {
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 static int p981x_cmds(struct p981x_dev *ppd) {
 	char* endp;
 	char* cp;
@@ -128,14 +188,9 @@ static int p981x_cmds(struct p981x_dev *ppd) {
 
 	switch (ppd->line[0]) {
 	case 'N':
-		rc = sscanf(&ppd->line[1], "%d", &ppd->count);
-		if (ppd->buffer) {
-			kfree(ppd->buffer);
-			ppd->buffer = NULL;
-		}
-		if (ppd->count > 0) {
-			ppd->buffer = kmalloc(sizeof(u32) * ppd->count, GFP_KERNEL);
-		}
+		i = 0;
+		rc = sscanf(&ppd->line[1], "%d", &i);
+		p981x_set_count(ppd, i);
 		break;
 
 	case 'D':
@@ -173,13 +228,18 @@ static ssize_t p981x_write(struct file *f, const char __user *buf,
 			     size_t len, loff_t *f_pos)
 {
 	struct p981x_dev *ppd = to_p981x_dev(f->private_data);
-	size_t i;
+	char chunk[P981X_WRITE_CHUNK];
+	size_t i, n = 0;
 	char ch;
 
 	for (i = 0; i < len; i++) {
-		if (copy_from_user(&ch, buf + i, 1)) {
-			return -EFAULT;
+		if (i % P981X_WRITE_CHUNK == 0) {
+			n = min(len - i, sizeof chunk);
+			if (copy_from_user(chunk, buf + i, n)) {
+				return -EFAULT;
+			}
 		}
+		ch = chunk[i % P981X_WRITE_CHUNK];
 
 		switch (ch) {
 		case '\r':
@@ -206,6 +266,49 @@ static ssize_t p981x_write(struct file *f, const char __user *buf,
 	return len;
 }
 
+/* Take the colors from the mmap()ed RGB and send them */
+static int p981x_commit(struct p981x_dev *ppd) {
+	const u8* rgb = page_address(ppd->rgb);
+	int i;
+
+	for (i = 0; i < ppd->count && i < P981X_LEDS_MAX && ppd->buffer; i++) {
+		ppd->buffer[i] = p981x_color(rgb[0], rgb[1], rgb[2]);
+		rgb += 3;
+	}
+	return p981x_send_frame(ppd);
+}
+
+static long p981x_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct p981x_dev *ppd = to_p981x_dev(f->private_data);
+
+	switch (cmd) {
+	case P981X_IOC_SET_COUNT:
+		if (arg > P981X_LEDS_MAX) {
+			return -EINVAL;
+		}
+		return p981x_set_count(ppd, arg);
+
+	case P981X_IOC_COMMIT:
+		return p981x_commit(ppd);
+	}
+	return -ENOTTY;
+}
+
+static int p981x_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	struct p981x_dev *ppd = to_p981x_dev(f->private_data);
+
+	/* a private copy would never reach P981X_IOC_COMMIT */
+	if (!(vma->vm_flags & VM_SHARED)) {
+		return -EINVAL;
+	}
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE) {
+		return -EINVAL;
+	}
+	return vm_insert_page(vma, vma->vm_start, ppd->rgb);
+}
+
 static int p981x_open(struct inode *inode, struct file *f)
 {
 	struct p981x_dev *ppd = to_p981x_dev(f->private_data);
@@ -229,6 +332,9 @@ static int p981x_release(struct inode *inode, struct file *f)
 static const struct file_operations p981x_fops = {
 	.owner		= THIS_MODULE,
 	.write		= p981x_write,
+	.unlocked_ioctl	= p981x_ioctl,
+	.compat_ioctl	= p981x_ioctl,
+	.mmap		= p981x_mmap,
 	.open		= p981x_open,
 	.release	= p981x_release
 };
@@ -236,7 +342,8 @@ static const struct file_operations p981x_fops = {
 static const struct miscdevice misc_def = {
 	.minor		= MISC_DYNAMIC_MINOR,
 	.name		= DEV_NAME,
-	.mode		= S_IWUGO,
+	/* mmap() needs read access */
+	.mode		= S_IRUGO | S_IWUGO,
 	.fops		= &p981x_fops
 };
 
@@ -263,10 +370,59 @@ static int p981x_gpio_init(int gpio)
 	return 0;
 }
 
+static int p981x_register(struct device *parent, struct p981x_dev *ppd)
+{
+	struct device *dev;
+	int rc;
+
+	mutex_init(&ppd->mutex);
+
+	ppd->rgb = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!ppd->rgb) {
+		return -ENOMEM;
+	}
+
+	ppd->miscdev = misc_def;
+	ppd->miscdev.name = kasprintf(GFP_KERNEL, "%s%d",
+				misc_def.name, dev_index++);
+	rc = misc_register(&ppd->miscdev);
+	if (rc) {
+		pr_err("Failed to register as misc device %s\n", misc_def.name);
+		kfree(ppd->miscdev.name);
+		__free_page(ppd->rgb);
+		return rc;
+	}
+
+	/* platform/spi device drvdata */
+	dev_set_drvdata(parent, ppd);
+
+	/* misc device drvdata */
+	dev = ppd->miscdev.this_device;
+	dev_set_drvdata(dev, ppd);
+	return 0;
+}
+
+static void p981x_unregister(struct p981x_dev *ppd)
+{
+	if (ppd->buffer) {
+		kfree(ppd->buffer);
+		ppd->buffer = NULL;
+	}
+	if (ppd->frame) {
+		kfree(ppd->frame);
+		ppd->frame = NULL;
+	}
+
+	misc_deregister(&ppd->miscdev);
+	kfree(ppd->miscdev.name);
+	/* Mappings still around keep their own reference */
+	__free_page(ppd->rgb);
+	kfree(ppd);
+}
+
 static int p981x_probe(struct platform_device *pdev)
 {
 	struct device_node *np = pdev->dev.of_node;
-	struct device *dev;
 	struct p981x_dev *ppd;
 	int rc;
 
@@ -297,24 +453,11 @@ static int p981x_probe(struct platform_device *pdev)
 		goto free_p981x;
 	}
 
-	mutex_init(&ppd->mutex);
-
-	ppd->miscdev = misc_def;
-	ppd->miscdev.name = kasprintf(GFP_KERNEL, "%s%d",
-				misc_def.name, dev_index++);
-	rc = misc_register(&ppd->miscdev);
+	rc = p981x_register(&pdev->dev, ppd);
 	if (rc) {
-		pr_err("Failed to register as misc device %s\n", misc_def.name);
 		goto free_p981x;
 	}
 
-	/* platform device drvdata */
-	dev_set_drvdata(&pdev->dev, ppd);
-
-	/* misc device drvdata */
-	dev = ppd->miscdev.this_device;
-	dev_set_drvdata(dev, ppd);
-
 	pr_info("device %s registered, using clock:%d data:%d\n",
 		ppd->miscdev.name, ppd->pin_clk, ppd->pin_data);
 	return 0;
@@ -331,14 +474,51 @@ static int p981x_remove(struct platform_device *pdev)
 	gpio_free(ppd->pin_clk);
 	gpio_free(ppd->pin_data);
 
-	if (ppd->buffer) {
-		kfree(ppd->buffer);
-		ppd->buffer = NULL;
+	p981x_unregister(ppd);
+	return 0;
+}
+
+static int p981x_spi_probe(struct spi_device *spi)
+{
+	struct p981x_dev *ppd;
+	int rc;
+
+	ppd = kzalloc(sizeof(*ppd), GFP_KERNEL);
+	if (!ppd) {
+		return -ENOMEM;
 	}
+	ppd->pin_clk = ppd->pin_data = -1;
 
-	misc_deregister(&ppd->miscdev);
-	kfree(ppd->miscdev.name);
+	/* Data latched on the rising edge, clock idle high: SPI mode 3 */
+	spi->mode = SPI_MODE_3;
+	spi->bits_per_word = 8;
+	if (!spi->max_speed_hz || spi->max_speed_hz > P981X_SPI_HZ_MAX) {
+		spi->max_speed_hz = P981X_SPI_HZ_MAX;
+	}
+	rc = spi_setup(spi);
+	if (rc) {
+		pr_err("Failed to setup SPI %s\n", dev_name(&spi->dev));
+		goto free_p981x;
+	}
+	ppd->spi = spi;
+
+	rc = p981x_register(&spi->dev, ppd);
+	if (rc) {
+		goto free_p981x;
+	}
+
+	pr_info("device %s registered, using %s at %u Hz\n",
+		ppd->miscdev.name, dev_name(&spi->dev), spi->max_speed_hz);
+	return 0;
+
+free_p981x:
 	kfree(ppd);
+	return rc;
+}
+
+static int p981x_spi_remove(struct spi_device *spi)
+{
+	p981x_unregister(spi_get_drvdata(spi));
 	return 0;
 }
 
@@ -356,7 +536,45 @@ static struct platform_driver p981x_driver = {
 	.remove	= p981x_remove,
 };
 
-module_platform_driver(p981x_driver);
+static const struct spi_device_id p981x_spi_id[] = {
+	{ DEV_NAME, 0 },
+	{ },
+};
+MODULE_DEVICE_TABLE(spi, p981x_spi_id);
+
+static struct spi_driver p981x_spi_driver = {
+	.driver	= {
+		.name		= DEV_NAME,
+		.of_match_table	= p981x_match,
+	},
+	.probe	= p981x_spi_probe,
+	.remove	= p981x_spi_remove,
+	.id_table = p981x_spi_id,
+};
+
+static int __init p981x_init(void)
+{
+	int rc;
+
+	rc = platform_driver_register(&p981x_driver);
+	if (rc) {
+		return rc;
+	}
+
+	rc = spi_register_driver(&p981x_spi_driver);
+	if (rc) {
+		platform_driver_unregister(&p981x_driver);
+	}
+	return rc;
+}
+module_init(p981x_init);
+
+static void __exit p981x_exit(void)
+{
+	spi_unregister_driver(&p981x_spi_driver);
+	platform_driver_unregister(&p981x_driver);
+}
+module_exit(p981x_exit);
 
 MODULE_DEVICE_TABLE(of, p981x_match);
 MODULE_LICENSE("GPL v2");
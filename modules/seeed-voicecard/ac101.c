@@ -32,6 +32,7 @@
 #include <sound/tlv.h>
 #include <linux/i2c.h>
 #include <linux/irq.h>
+#include <linux/interrupt.h>
 #include <linux/workqueue.h>
 #include <linux/clk.h>
 #include <linux/gpio/consumer.h>
@@ -73,11 +74,19 @@ static bool drc_used		= false;
 static struct ac10x_priv* static_ac10x;
 
 
+static bool ac101_volatile_reg(struct device *dev, unsigned int reg);
+
 int ac101_read(struct snd_soc_codec *codec, unsigned reg) {
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
+	u64 t0 = ac10x_prof_start();
 	int r, v = 0;
 
-	if ((r = regmap_read(ac10x->regmap101, reg, &v)) < 0) {
+	r = regmap_read(ac10x->regmap101, reg, &v);
+	if (t0) {
+		ac10x_prof_account(t0, AC101_I2C_ID, reg, AC10X_PROF_READ |
+				   (ac101_volatile_reg(NULL, reg)? AC10X_PROF_BUS_READ: 0));
+	}
+	if (r < 0) {
 		dev_err(codec->dev, "read reg %02X fail\n",
 			 reg);
 		return r;
@@ -87,9 +96,13 @@ int ac101_read(struct snd_soc_codec *codec, unsigned reg) {
 
 int ac101_write(struct snd_soc_codec *codec, unsigned reg, unsigned val) {
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
+	u64 t0 = ac10x_prof_start();
 	int v;
 
 	v = regmap_write(ac10x->regmap101, reg, val);
+	if (t0) {
+		ac10x_prof_account(t0, AC101_I2C_ID, reg, AC10X_PROF_WRITE | AC10X_PROF_BUS_WRITE);
+	}
 	return v;
 }
 
@@ -97,9 +110,16 @@ int ac101_update_bits(struct snd_soc_codec *codec, unsigned reg,
 			unsigned mask, unsigned value
 ) {
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
+	u64 t0 = ac10x_prof_start();
+	bool change = false;
 	int v;
 
-	v = regmap_update_bits(ac10x->regmap101, reg, mask, value);
+	v = regmap_update_bits_check(ac10x->regmap101, reg, mask, value, &change);
+	if (t0) {
+		ac10x_prof_account(t0, AC101_I2C_ID, reg, AC10X_PROF_READ | AC10X_PROF_WRITE |
+				   (ac101_volatile_reg(NULL, reg)? AC10X_PROF_BUS_READ: 0) |
+				   (change? AC10X_PROF_BUS_WRITE: 0));
+	}
 	return v;
 }
 
@@ -110,50 +130,57 @@ int ac101_update_bits(struct snd_soc_codec *codec, unsigned reg,
 /********************************switch****************************************/
 /******************************************************************************/
 #define KEY_HEADSETHOOK         226		/* key define */
-#define HEADSET_FILTER_CNT	(10)
+
+/*
+ * Jack engine, run by the threaded irq only.
+ * HMIC data is refreshed at 32Hz (down by 4), a plug is sensed by sampling
+ * it until JACK_STABLE_CNT samples agree; buttons are confirmed by a second
+ * sample after JACK_*_CONFIRM_MS. Nothing else touches the bus on an event.
+ */
+#define JACK_SAMPLE_MS		40
+#define JACK_STABLE_CNT		3
+#define JACK_SAMPLE_MAX		25		/* ~1s, then the last sample counts */
+#define JACK_HOOK_CONFIRM_MS	150
+#define JACK_VOL_CONFIRM_MS	80
 
 /*
  * switch_hw_config:config the 53 codec register
+ * register cache backed, only fields differing from it reach the bus
  */
 static void switch_hw_config(struct snd_soc_codec *codec)
 {
-	int r;
-
 	AC101_DBG();
 
 	/*HMIC/MMIC BIAS voltage level select:2.5v*/
 	ac101_update_bits(codec, OMIXER_BST1_CTRL, (0xf<<BIASVOLTAGE), (0xf<<BIASVOLTAGE));
-	/*debounce when Key down or keyup*/
-	ac101_update_bits(codec, HMIC_CTRL1, (0xf<<HMIC_M), (0x0<<HMIC_M));
-	/*debounce when earphone plugin or pullout*/
-	ac101_update_bits(codec, HMIC_CTRL1, (0xf<<HMIC_N), (0x0<<HMIC_N));
-	/*Down Sample Setting Select: Downby 4,32Hz*/
-	ac101_update_bits(codec, HMIC_CTRL2, (0x3<<HMIC_SAMPLE_SELECT), (0x02<<HMIC_SAMPLE_SELECT));
-	/*Hmic_th2 for detecting Keydown or Keyup.*/
-	ac101_update_bits(codec, HMIC_CTRL2, (0x1f<<HMIC_TH2), (0x8<<HMIC_TH2));
-	/*Hmic_th1[4:0],detecting eraphone plugin or pullout*/
-	ac101_update_bits(codec, HMIC_CTRL2, (0x1f<<HMIC_TH1), (0x1<<HMIC_TH1));
-	/*Headset microphone BIAS working mode: when HBIASEN = 1 */
-	ac101_update_bits(codec, ADC_APC_CTRL, (0x1<<HBIASMOD), (0x1<<HBIASMOD));
-	/*Headset microphone BIAS Enable*/
-	ac101_update_bits(codec, ADC_APC_CTRL, (0x1<<HBIASEN), (0x1<<HBIASEN));
-	/*Headset microphone BIAS Current sensor & ADC Enable*/
-	ac101_update_bits(codec, ADC_APC_CTRL, (0x1<<HBIASADCEN), (0x1<<HBIASADCEN));
-	/*Earphone Plugin/out Irq Enable*/
-	ac101_update_bits(codec, HMIC_CTRL1, (0x1<<HMIC_PULLOUT_IRQ), (0x1<<HMIC_PULLOUT_IRQ));
-	ac101_update_bits(codec, HMIC_CTRL1, (0x1<<HMIC_PLUGIN_IRQ), (0x1<<HMIC_PLUGIN_IRQ));
-
-	/*Hmic KeyUp/key down Irq Enable*/
-	ac101_update_bits(codec, HMIC_CTRL1, (0x1<<HMIC_KEYDOWN_IRQ), (0x1<<HMIC_KEYDOWN_IRQ));
-	ac101_update_bits(codec, HMIC_CTRL1, (0x1<<HMIC_KEYUP_IRQ), (0x1<<HMIC_KEYUP_IRQ));
+	/*
+	 * debounce when Key down or keyup, when earphone plugin or pullout: none
+	 * Earphone Plugin/out, Hmic KeyUp/key down Irq Enable
+	 */
+	ac101_update_bits(codec, HMIC_CTRL1,
+		(0xf<<HMIC_M) | (0xf<<HMIC_N) |
+		(0x1<<HMIC_PULLOUT_IRQ) | (0x1<<HMIC_PLUGIN_IRQ) |
+		(0x1<<HMIC_KEYDOWN_IRQ) | (0x1<<HMIC_KEYUP_IRQ),
+		(0x0<<HMIC_M) | (0x0<<HMIC_N) |
+		(0x1<<HMIC_PULLOUT_IRQ) | (0x1<<HMIC_PLUGIN_IRQ) |
+		(0x1<<HMIC_KEYDOWN_IRQ) | (0x1<<HMIC_KEYUP_IRQ));
+	/*
+	 * Down Sample Setting Select: Downby 4,32Hz
+	 * Hmic_th2 for detecting Keydown or Keyup.
+	 * Hmic_th1[4:0],detecting eraphone plugin or pullout
+	 */
+	ac101_update_bits(codec, HMIC_CTRL2,
+		(0x3<<HMIC_SAMPLE_SELECT) | (0x1f<<HMIC_TH2) | (0x1f<<HMIC_TH1),
+		(0x02<<HMIC_SAMPLE_SELECT) | (0x8<<HMIC_TH2) | (0x1<<HMIC_TH1));
+	/*Headset microphone BIAS working mode, Enable, Current sensor & ADC Enable*/
+	ac101_update_bits(codec, ADC_APC_CTRL,
+		(0x1<<HBIASMOD) | (0x1<<HBIASEN) | (0x1<<HBIASADCEN),
+		(0x1<<HBIASMOD) | (0x1<<HBIASEN) | (0x1<<HBIASADCEN));
 
 	/*headphone calibration clock frequency select*/
 	ac101_update_bits(codec, SPKOUT_CTRL, (0x7<<HPCALICKS), (0x7<<HPCALICKS));
 
-	/*clear hmic interrupt */
-	r = HMIC_PEND_ALL;
-	ac101_write(codec, HMIC_STS, r);
-
+	/* pending interrupts are cleared by the next jack engine pass */
 	return;
 }
 
@@ -169,42 +196,6 @@ static void switch_status_update(struct ac10x_priv *ac10x)
         return;
 }
 
-/*
- * work_cb_clear_irq: clear audiocodec pending and Record the interrupt.
- */
-static void work_cb_clear_irq(struct work_struct *work)
-{
-	int reg_val = 0;
-	struct ac10x_priv *ac10x = container_of(work, struct ac10x_priv, work_clear_irq);
-	struct snd_soc_codec *codec = ac10x->codec;
-
-	ac10x->irq_cntr++;
-
-	reg_val = ac101_read(codec, HMIC_STS);
-	if (BIT(HMIC_PULLOUT_PEND) & reg_val) {
-		ac10x->pullout_cntr++;
-		AC101_DBG("ac10x->pullout_cntr: %d\n", ac10x->pullout_cntr);
-	}
-
-	reg_val |= HMIC_PEND_ALL;
-	ac101_write(codec, HMIC_STS, reg_val);
-
-	reg_val = ac101_read(codec, HMIC_STS);
-	if ((reg_val & HMIC_PEND_ALL) != 0){
-		reg_val |= HMIC_PEND_ALL;
-		ac101_write(codec, HMIC_STS, reg_val);
-	}
-
-	if (cancel_work_sync(&ac10x->work_switch) != 0) {
-		ac10x->irq_cntr--;
-	}
-
-	if (0 == schedule_work(&ac10x->work_switch)) {
-		ac10x->irq_cntr--;
-		AC101_DBG("[work_cb_clear_irq] add work struct failed!\n");
-	}
-}
-
 enum {
 	HBIAS_LEVEL_1 = 0x02,
 	HBIAS_LEVEL_2 = 0x0B,
@@ -213,154 +204,171 @@ enum {
 	HBIAS_LEVEL_5 = 0x19,
 };
 
+/* one HMIC_STS read, plus the data pending clear when it is set */
 static int __ac101_get_hmic_data(struct snd_soc_codec *codec) {
 	#ifdef AC101_DEBG
 	static long counter;
 	#endif
 	int r, d;
 
-	d = GET_HMIC_DATA(ac101_read(codec, HMIC_STS));
-
-	r = 0x1 << HMIC_DATA_PEND;
-	ac101_write(codec, HMIC_STS, r);
+	r = ac101_read(codec, HMIC_STS);
+	if (r < 0)
+		return r;
+	d = GET_HMIC_DATA(r);
 
-	/* prevent i2c accessing too frequently */
-	usleep_range(1500, 3000);
+	if (r & (0x1 << HMIC_DATA_PEND)) {
+		ac101_write(codec, HMIC_STS, 0x1 << HMIC_DATA_PEND);
+	}
 
 	AC101_DBG("HMIC_DATA(%3ld): %02X\n", counter++, d);
 	return d;
 }
 
-/*
- * work_cb_earphone_switch: judge the status of the headphone
- */
-static void work_cb_earphone_switch(struct work_struct *work)
-{
-	struct ac10x_priv *ac10x = container_of(work, struct ac10x_priv, work_switch);
-	struct snd_soc_codec *codec = ac10x->codec;
-
-	static int hook_flag1 = 0, hook_flag2 = 0;
-	static int KEY_VOLUME_FLAG = 0;
-
-	unsigned filter_buf = 0;
-	int filt_index = 0;
-	int t = 0;
-
-	ac10x->irq_cntr--;
-
-	/* read HMIC_DATA */
-	t = __ac101_get_hmic_data(codec);
+/* HMIC data once stable, or the last sample if it never settles */
+static int ac101_jack_sense(struct snd_soc_codec *codec) {
+	int i, d, last = -1, stable = 0;
 
-	if ((t >= HBIAS_LEVEL_2) && (ac10x->mode == FOUR_HEADPHONE_PLUGIN)) {
-		t = __ac101_get_hmic_data(codec);
+	for (i = 0; i < JACK_SAMPLE_MAX; i++) {
+		if (i) {
+			msleep(JACK_SAMPLE_MS);
+		}
+		d = __ac101_get_hmic_data(codec);
+		if (d < 0)
+			return d;
 
-		if (t >= HBIAS_LEVEL_5){
-			msleep(150);
-			t = __ac101_get_hmic_data(codec);
-			if (((t < HBIAS_LEVEL_2 && t >= HBIAS_LEVEL_1 - 1) || t >= HBIAS_LEVEL_5)
-			&& (ac10x->pullout_cntr == 0)) {
-				input_report_key(ac10x->inpdev, KEY_HEADSETHOOK, 1);
-				input_sync(ac10x->inpdev);
+		stable = (d == last)? stable + 1: 1;
+		last = d;
+		if (stable >= JACK_STABLE_CNT)
+			break;
+	}
+	return last;
+}
 
-				AC101_DBG("KEY_HEADSETHOOK1\n");
+static void ac101_jack_release(struct ac10x_priv *ac10x) {
+	if (!ac10x->jack_key)
+		return;
 
-				if (hook_flag1 != hook_flag2)
-					hook_flag1 = hook_flag2 = 0;
-				hook_flag1++;
-			}
-			if (ac10x->pullout_cntr)
-				ac10x->pullout_cntr--;
-		} else if (t >= HBIAS_LEVEL_4) {
-			msleep(80);
-			t = __ac101_get_hmic_data(codec);
-			if (t < HBIAS_LEVEL_5 && t >= HBIAS_LEVEL_4 && (ac10x->pullout_cntr == 0)) {
-				KEY_VOLUME_FLAG = 1;
-				input_report_key(ac10x->inpdev, KEY_VOLUMEUP, 1);
-				input_sync(ac10x->inpdev);
-				input_report_key(ac10x->inpdev, KEY_VOLUMEUP, 0);
-				input_sync(ac10x->inpdev);
-
-				AC101_DBG("HMIC_DATA: %d KEY_VOLUMEUP\n", t);
-			}
-			if (ac10x->pullout_cntr)
-				ac10x->pullout_cntr--;
-		} else if (t >= HBIAS_LEVEL_3){
-			msleep(80);
-			t = __ac101_get_hmic_data(codec);
-			if (t < HBIAS_LEVEL_4 && t >= HBIAS_LEVEL_3  && (ac10x->pullout_cntr == 0)){
-				KEY_VOLUME_FLAG = 1;
-				input_report_key(ac10x->inpdev, KEY_VOLUMEDOWN, 1);
-				input_sync(ac10x->inpdev);
-				input_report_key(ac10x->inpdev, KEY_VOLUMEDOWN, 0);
-				input_sync(ac10x->inpdev);
-				AC101_DBG("KEY_VOLUMEDOWN\n");
-			}
-			if (ac10x->pullout_cntr)
-				ac10x->pullout_cntr--;
-		}
-	} else if ((t < HBIAS_LEVEL_2 && t >= HBIAS_LEVEL_1) && (ac10x->mode == FOUR_HEADPHONE_PLUGIN)) {
-		t = __ac101_get_hmic_data(codec);
-		if (t < HBIAS_LEVEL_2 && t >= HBIAS_LEVEL_1) {
-			if (KEY_VOLUME_FLAG) {
-				KEY_VOLUME_FLAG = 0;
-			}
-			if (hook_flag1 == (++hook_flag2)) {
-				hook_flag1 = hook_flag2 = 0;
-				input_report_key(ac10x->inpdev, KEY_HEADSETHOOK, 0);
-				input_sync(ac10x->inpdev);
+	input_report_key(ac10x->inpdev, ac10x->jack_key, 0);
+	input_sync(ac10x->inpdev);
+	AC101_DBG("key %d up\n", ac10x->jack_key);
+	ac10x->jack_key = 0;
+}
 
-				AC101_DBG("KEY_HEADSETHOOK0\n");
-			}
-		}
+/* new plug state from stable HMIC data, reported when it changed */
+static void ac101_jack_set(struct ac10x_priv *ac10x, int d, int force) {
+	enum headphone_mode_u mode;
+	int state;
+
+	if (d >= HBIAS_LEVEL_2) {
+		mode = THREE_HEADPHONE_PLUGIN;
+		state = 2;
+	} else if (d >= HBIAS_LEVEL_1 - 1) {
+		mode = FOUR_HEADPHONE_PLUGIN;
+		state = 1;
 	} else {
-		while (ac10x->irq_cntr == 0 && ac10x->irq != 0) {
-			msleep(20);
-
-			t = __ac101_get_hmic_data(codec);
-
-			if (filt_index <= HEADSET_FILTER_CNT) {
-				if (filt_index++ == 0) {
-					filter_buf = t;
-				} else if (filter_buf != t) {
-					filt_index = 0;
-				}
-				continue;
-			}
+		mode = HEADPHONE_IDLE;
+		state = 0;
+	}
 
-			filt_index = 0;
-			if (filter_buf >= HBIAS_LEVEL_2) {
-				ac10x->mode = THREE_HEADPHONE_PLUGIN;
-				ac10x->state = 2;
-			} else if (filter_buf >= HBIAS_LEVEL_1 - 1) {
-				ac10x->mode = FOUR_HEADPHONE_PLUGIN;
-				ac10x->state = 1;
-			} else {
-				ac10x->mode = HEADPHONE_IDLE;
-				ac10x->state = 0;
-			}
-			switch_status_update(ac10x);
-			ac10x->pullout_cntr = 0;
-			break;
-		}
+	if (mode != FOUR_HEADPHONE_PLUGIN) {
+		ac101_jack_release(ac10x);
 	}
+	ac10x->mode = mode;
+	if (state == ac10x->state && !force)
+		return;
+	ac10x->state = state;
+	switch_status_update(ac10x);
+}
+
+static int ac101_jack_key(int d) {
+	if (d >= HBIAS_LEVEL_5)
+		return KEY_HEADSETHOOK;
+	if (d >= HBIAS_LEVEL_4)
+		return KEY_VOLUMEUP;
+	if (d >= HBIAS_LEVEL_3)
+		return KEY_VOLUMEDOWN;
+	return 0;
 }
 
 /*
- * audio_hmic_irq:  the interrupt handlers
+ * audio_hmic_irq:  the threaded interrupt handler, the jack engine
+ *
+ * One HMIC_STS read gives both the pending events and the HMIC data:
+ * a plug/pullout (or any event while no four pole headset is in) senses
+ * the jack, anything else with a four pole headset is a button.
  */
 static irqreturn_t audio_hmic_irq(int irq, void *para)
 {
 	struct ac10x_priv *ac10x = (struct ac10x_priv *)para;
+	struct snd_soc_codec *codec;
+	int r, d, key, force;
+
 	if (ac10x == NULL) {
-		return -EINVAL;
+		return IRQ_NONE;
 	}
+	codec = ac10x->codec;
 
-	if (0 == schedule_work(&ac10x->work_clear_irq)){
-		AC101_DBG("[audio_hmic_irq] work already in queue_codec_irq, adding failed!\n");
+	r = ac101_read(codec, HMIC_STS);
+	if (r < 0) {
+		return IRQ_NONE;
+	}
+	if (r & HMIC_PEND_ALL) {
+		ac101_write(codec, HMIC_STS, r | HMIC_PEND_ALL);
 	}
+
+	force = atomic_xchg(&ac10x->jack_resync, 0);
+	if (force || ac10x->mode != FOUR_HEADPHONE_PLUGIN
+	|| (r & ((0x1 << HMIC_PLUGIN_PEND) | (0x1 << HMIC_PULLOUT_PEND)))) {
+		d = ac101_jack_sense(codec);
+		if (d >= 0) {
+			ac101_jack_set(ac10x, d, force);
+		}
+		return IRQ_HANDLED;
+	}
+
+	d = GET_HMIC_DATA(r);
+	key = ac101_jack_key(d);
+	if (!key) {
+		if (d < HBIAS_LEVEL_2) {
+			ac101_jack_release(ac10x);
+		}
+		return IRQ_HANDLED;
+	}
+	if (ac10x->jack_key) {
+		return IRQ_HANDLED;
+	}
+
+	msleep(key == KEY_HEADSETHOOK? JACK_HOOK_CONFIRM_MS: JACK_VOL_CONFIRM_MS);
+	d = __ac101_get_hmic_data(codec);
+	/* a hook tap may be over already, the volume keys must still be held */
+	if (ac101_jack_key(d) != key
+	&& !(key == KEY_HEADSETHOOK && d >= HBIAS_LEVEL_1 - 1 && d < HBIAS_LEVEL_2)) {
+		return IRQ_HANDLED;
+	}
+
+	input_report_key(ac10x->inpdev, key, 1);
+	input_sync(ac10x->inpdev);
+	AC101_DBG("key %d down, HMIC_DATA: %d\n", key, d);
+
+	if (key == KEY_HEADSETHOOK && d >= HBIAS_LEVEL_5) {
+		/* released by the key up event */
+		ac10x->jack_key = key;
+		return IRQ_HANDLED;
+	}
+	input_report_key(ac10x->inpdev, key, 0);
+	input_sync(ac10x->inpdev);
 	return IRQ_HANDLED;
 }
 
+/* jack state unknown (probe, resume): sense it again and report it */
+static void ac101_jack_resync(struct ac10x_priv *ac10x) {
+	if (!ac10x->irq)
+		return;
+
+	atomic_set(&ac10x->jack_resync, 1);
+	irq_wake_thread(ac10x->irq, ac10x);
+}
+
 static int ac101_switch_probe(struct ac10x_priv *ac10x) {
 	struct i2c_client *i2c = ac10x->i2c101;
 	long ret;
@@ -381,19 +389,10 @@ static int ac101_switch_probe(struct ac10x_priv *ac10x) {
 		goto _err_irq;
 	}
 
-	/* request irq, set irq type to falling edge trigger */
-	ret = devm_request_irq(ac10x->codec->dev, ac10x->irq, audio_hmic_irq, IRQF_TRIGGER_FALLING, "SWTICH_EINT", ac10x);
-	if (IS_ERR_VALUE(ret)) {
-		pr_info("[ac101] request virq %ld failed, errno = %ld\n", ac10x->irq, ret);
-		goto _err_irq;
-	}
-
 	ac10x->mode = HEADPHONE_IDLE;
 	ac10x->state = -1;
-
-	/*use for judge the state of switch*/
-	INIT_WORK(&ac10x->work_switch, work_cb_earphone_switch);
-	INIT_WORK(&ac10x->work_clear_irq, work_cb_clear_irq);
+	ac10x->jack_key = 0;
+	atomic_set(&ac10x->jack_resync, 0);
 
 	/********************create input device************************/
 	ac10x->inpdev = devm_input_allocate_device(ac10x->codec->dev);
@@ -422,24 +421,31 @@ static int ac101_switch_probe(struct ac10x_priv *ac10x) {
 		goto _err_input_register_device;
 	}
 
+	/*
+	 * request irq, set irq type to falling edge trigger,
+	 * handled in a thread: the jack engine sleeps on the i2c bus
+	 */
+	ret = devm_request_threaded_irq(ac10x->codec->dev, ac10x->irq, NULL, audio_hmic_irq,
+				IRQF_TRIGGER_FALLING | IRQF_ONESHOT, "SWTICH_EINT", ac10x);
+	if (IS_ERR_VALUE(ret)) {
+		pr_info("[ac101] request virq %ld failed, errno = %ld\n", ac10x->irq, ret);
+		ac10x->irq = 0;
+		goto _err_irq;
+	}
+
 	/* the first headset state checking */
 	switch_hw_config(ac10x->codec);
-	ac10x->irq_cntr = 1;
-	schedule_work(&ac10x->work_switch);
+	ac101_jack_resync(ac10x);
 
 	return 0;
 
 _err_input_register_device:
 _err_input_allocate_device:
-
-	if (ac10x->irq) {
-		devm_free_irq(&i2c->dev, ac10x->irq, ac10x);
-		ac10x->irq = 0;
-	}
+	ac10x->inpdev = NULL;
+	ac10x->irq = 0;
 _err_irq:
 	return ret;
 }
-/******************************************************************************/
 /********************************switch****************************************/
 /******************************************************************************/
 #endif
@@ -1237,10 +1243,16 @@ int ac101_audio_startup(struct snd_pcm_substream *substream,
 }
 
 #if _MASTER_MULTI_CODEC == _MASTER_AC101
-static int ac101_set_clock(int y_start_n_stop) {
-	int r;
+static int ac101_set_clock(int cmd) {
+	int r, path;
 
-	if (y_start_n_stop) {
+	if (cmd == SEEED_CLOCK_PREPARE) {
+		/* nothing to warm up, AIF1 clock gates the LRCK */
+		return 0;
+	}
+
+	path = ac10x_prof_enter(AC10X_PATH_SET_CLOCK);
+	if (cmd == SEEED_CLOCK_START) {
 		/* enable global clock */
 		r = ac101_aif1clk(static_ac10x->codec, SND_SOC_DAPM_PRE_PMU, 1);
 	} else {
@@ -1248,6 +1260,7 @@ static int ac101_set_clock(int y_start_n_stop) {
 		static_ac10x->aif1_clken = 1;
 		r = ac101_aif1clk(static_ac10x->codec, SND_SOC_DAPM_POST_PMD, 0);
 	}
+	ac10x_prof_leave(path);
 	return r;
 }
 #endif
@@ -1375,8 +1388,7 @@ int ac101_set_bias_level(struct snd_soc_codec *codec, enum snd_soc_bias_level le
 		break;
 	case SND_SOC_BIAS_OFF:
 		#ifdef CONFIG_AC101_SWITCH_DETECT
-		ac101_update_bits(codec, ADC_APC_CTRL, (0x1<<HBIASEN), (0<<HBIASEN));
-		ac101_update_bits(codec, ADC_APC_CTRL, (0x1<<HBIASADCEN), (0<<HBIASADCEN));
+		ac101_update_bits(codec, ADC_APC_CTRL, (0x1<<HBIASEN) | (0x1<<HBIASADCEN), 0);
 		#endif
 		ac101_update_bits(codec, OMIXER_DACA_CTRL, (0xf<<HPOUTPUTENABLE), (0<<HPOUTPUTENABLE));
 		ac101_update_bits(codec, ADDA_TUNE3, (0x1<<OSCEN), (0<<OSCEN));
@@ -1406,7 +1418,7 @@ int ac101_codec_probe(struct snd_soc_codec *codec)
 	mutex_init(&ac10x->dac_mutex);
 
 	#if _MASTER_MULTI_CODEC == _MASTER_AC101
-	seeed_voice_card_register_set_clock(SNDRV_PCM_STREAM_PLAYBACK, ac101_set_clock);
+	seeed_voice_card_register_set_clock(codec->dev, SNDRV_PCM_STREAM_PLAYBACK, ac101_set_clock);
 	#endif
 
 	set_configuration(ac10x->codec);
@@ -1444,17 +1456,12 @@ int ac101_codec_remove(struct snd_soc_codec *codec)
 	#ifdef CONFIG_AC101_SWITCH_DETECT
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
 
+	/* waits for a running jack engine pass */
 	if (ac10x->irq) {
 		devm_free_irq(codec->dev, ac10x->irq, ac10x);
 		ac10x->irq = 0;
 	}
 
-	if (cancel_work_sync(&ac10x->work_switch) != 0) {
-	}
-
-	if (cancel_work_sync(&ac10x->work_clear_irq) != 0) {
-	}
-
 	if (ac10x->inpdev) {
 		input_unregister_device(ac10x->inpdev);
 		ac10x->inpdev = NULL;
@@ -1489,12 +1496,11 @@ int ac101_codec_resume(struct snd_soc_codec *codec)
 		return ret;
 	}
 
+	ac101_set_bias_level(codec, SND_SOC_BIAS_STANDBY);
 	#ifdef CONFIG_AC101_SWITCH_DETECT
-	ac10x->mode = HEADPHONE_IDLE;
-	ac10x->state = -1;
+	/* the jack may have changed while suspended */
+	ac101_jack_resync(ac10x);
 	#endif
-
-	ac101_set_bias_level(codec, SND_SOC_BIAS_STANDBY);
 	schedule_work(&ac10x->codec_resume);
 	return 0;
 }
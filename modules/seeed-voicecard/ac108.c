@@ -20,6 +20,7 @@
 #include <linux/clk.h>
 #include <linux/i2c.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
 #include <linux/workqueue.h>
 #include <linux/regmap.h>
 #include <linux/gpio/consumer.h>
@@ -53,6 +54,11 @@ struct pll_div {
 
 static struct ac10x_priv *ac10x;
 
+/* keep PLL locked after the last stream stopped, a reopen skips the lock time */
+static unsigned pll_idle_ms = 5000;
+module_param(pll_idle_ms, uint, 0644);
+MODULE_PARM_DESC(pll_idle_ms, "ms to keep the PLL running after capture stops, 0 stops it at once");
+
 struct real_val_to_reg_val {
 	unsigned int real_val;
 	unsigned int reg_val;
@@ -170,7 +176,21 @@ static const struct pll_div ac108_pll_div_list[] = {
 static const DECLARE_TLV_DB_SCALE(tlv_adc_pga_gain, 0, 100, 0);
 static const DECLARE_TLV_DB_SCALE(tlv_ch_digital_vol, -11925,75,0);
 
+/* profiler chip index of an AC108 regmap */
+static int ac108_prof_chip(struct regmap* i2cm) {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ac10x->i2cmap); i++) {
+		if (ac10x->i2cmap[i] == i2cm) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* AC108 has no volatile register, reads are served by the FLAT cache */
 int ac10x_read(u8 reg, u8* rt_val, struct regmap* i2cm) {
+	u64 t0 = ac10x_prof_start();
 	int r, v = 0;
 
 	if ((r = regmap_read(i2cm, reg, &v)) < 0) {
@@ -178,24 +198,54 @@ int ac10x_read(u8 reg, u8* rt_val, struct regmap* i2cm) {
 	} else {
 		*rt_val = v;
 	}
+	if (t0) {
+		ac10x_prof_account(t0, ac108_prof_chip(i2cm), reg, AC10X_PROF_READ);
+	}
 	return r;
 }
 
 int ac10x_write(u8 reg, u8 val, struct regmap* i2cm) {
+	u64 t0 = ac10x_prof_start();
 	int r;
 
 	if ((r = regmap_write(i2cm, reg, val)) < 0) {
 		pr_err("ac10x_write error->[REG-0x%02x,val-0x%02x]\n", reg, val);
 	}
+	if (t0) {
+		ac10x_prof_account(t0, ac108_prof_chip(i2cm), reg,
+				   AC10X_PROF_WRITE | AC10X_PROF_BUS_WRITE);
+	}
 	return r;
 }
 
 int ac10x_update_bits(u8 reg, u8 mask, u8 val, struct regmap* i2cm) {
+	u64 t0 = ac10x_prof_start();
+	bool change = false;
 	int r;
 
-	if ((r = regmap_update_bits(i2cm, reg, mask, val)) < 0) {
+	if ((r = regmap_update_bits_check(i2cm, reg, mask, val, &change)) < 0) {
 		pr_err("%s() error->[REG-0x%02x,val-0x%02x]\n", __func__, reg, val);
 	}
+	if (t0) {
+		ac10x_prof_account(t0, ac108_prof_chip(i2cm), reg, AC10X_PROF_READ |
+				   AC10X_PROF_WRITE | (change? AC10X_PROF_BUS_WRITE: 0));
+	}
+	return r;
+}
+
+/* one auto-increment transfer, its time charged to the first register */
+static int ac10x_bulk_write(u8 reg, const u8* val, size_t cnt, struct regmap* i2cm) {
+	u64 t0 = ac10x_prof_start();
+	size_t i;
+	int r;
+
+	if ((r = regmap_bulk_write(i2cm, reg, val, cnt)) < 0) {
+		pr_err("%s() error->[REG-0x%02x,cnt-%zu]\n", __func__, reg, cnt);
+	}
+	for (i = 0; t0 && i < cnt; i++) {
+		ac10x_prof_account(i? ac10x_prof_start(): t0, ac108_prof_chip(i2cm), reg + i,
+				   AC10X_PROF_WRITE | AC10X_PROF_BUS_WRITE);
+	}
 	return r;
 }
 
@@ -575,75 +625,74 @@ static int ac108_config_pll(struct ac10x_priv *ac10x, unsigned rate, unsigned lr
 }
 
 /*
- * support no more than 16 slots.
+ * TDM slot allocation, support no more than 16 slots (4 chips).
+ *
+ * Stream channels are in natural order: the last chip's ADC1-4 first,
+ * chip 0 (the master) last, so on the 6-mic array the two AC101 echo
+ * channels, wired to ADC3/ADC4 of chip 0, are always the final two.
+ * CPU_DAI rotates channels by AC108_SLOT_ROTATE slots, channel p is
+ * therefore put on slot (p + AC108_SLOT_ROTATE) % slots.
+ *
+ * e.g. 2 chips:
+ * codec1 enable slots 2,3,4,5 -> channels 0-3
+ * codec0 enable slots 6,7,0,1 -> channels 4-7
  */
+#define AC108_ADC_CNT		4
+#define AC108_SLOT_ROTATE	2
+
+struct ac108_slot_map {
+	unsigned mask;		/* I2S_TX1_CTRL2/3, slot enable */
+	unsigned chmap;		/* I2S_TX1_CHMP_CTRL1-4, 2 bits ADC index per slot */
+};
+
+static void ac108_tdm_slot_alloc(int chips, struct ac108_slot_map *map) {
+	int slots = chips * AC108_ADC_CNT;
+	int c, adc, ch, slot;
+
+	for (c = 0; c < chips; c++) {
+		map[c].mask = map[c].chmap = 0;
+		for (adc = 0; adc < AC108_ADC_CNT; adc++) {
+			ch = (chips - 1 - c) * AC108_ADC_CNT + adc;
+			slot = (ch + AC108_SLOT_ROTATE) % slots;
+			map[c].mask  |= 1U << slot;
+			map[c].chmap |= adc << (slot * 2);
+		}
+	}
+}
+
 static int ac108_multi_chips_slots(struct ac10x_priv *ac, int slots) {
-	int i;
+	struct ac108_slot_map map[ARRAY_SIZE(ac->i2cmap)];
+	u8 ctrl[3], chmp[4];
+	int i, r = 0;
 
-	/*
-	 * codec0 enable slots 2,3,0,1 when 1 codec
-	 *
-	 * codec0 enable slots 6,7,0,1 when 2 codec
-	 * codec1 enable slots 2,3,4,5
-	 *
-	 * ...
-	 */
-	for (i = 0; i < ac->codec_cnt; i++) {
-		/* rotate map, due to channels rotated by CPU_DAI */
-		const unsigned vec_mask[] = {
-			0x3 << 6 | 0x3,	// slots 6,7,0,1
-			0xF << 2,	// slots 2,3,4,5
-			0,
-			0,
-		};
-		const unsigned vec_maps[] = {
-			/*
-			 * chip 0,
-			 * mic 0 sample -> slot 6
-			 * mic 1 sample -> slot 7
-			 * mic 2 sample -> slot 0
-			 * mic 3 sample -> slot 1
-			 */
-			0x0 << 12 | 0x1 << 14 | 0x2 << 0 | 0x3 << 2,
-			/*
-			 * chip 1,
-			 * mic 0 sample -> slot 2
-			 * mic 1 sample -> slot 3
-			 * mic 2 sample -> slot 4
-			 * mic 3 sample -> slot 5
-			 */
-			0x0 << 4  | 0x1 << 6  | 0x2 << 8 | 0x3 << 10,
-			0,
-			0,
-		};
-		unsigned vec;
+	if ((unsigned)ac->codec_cnt > ARRAY_SIZE(map)) {
+		return -EINVAL;
+	}
+	ac108_tdm_slot_alloc(ac->codec_cnt, map);
 
+	for (i = 0; i < ac->codec_cnt; i++) {
 		/* 0x38-0x3A I2S_TX1_CTRLx */
-		if (ac->codec_cnt == 1) {
-			vec = 0xFUL;
-		} else {
-			vec = vec_mask[i];
-		}
-		ac10x_write(I2S_TX1_CTRL1, slots - 1, ac->i2cmap[i]);
-		ac10x_write(I2S_TX1_CTRL2, (vec >> 0) & 0xFF, ac->i2cmap[i]);
-		ac10x_write(I2S_TX1_CTRL3, (vec >> 8) & 0xFF, ac->i2cmap[i]);
+		ctrl[0] = slots - 1;
+		ctrl[1] = (map[i].mask >> 0) & 0xFF;
+		ctrl[2] = (map[i].mask >> 8) & 0xFF;
 
 		/* 0x3C-0x3F I2S_TX1_CHMP_CTRLx */
-		if (ac->codec_cnt == 1) {
-			vec = (0x2 << 0 | 0x3 << 2 | 0x0 << 4 | 0x1 << 6);
-		} else if (ac->codec_cnt == 2) {
-			vec = vec_maps[i];
-		}
-
-		ac10x_write(I2S_TX1_CHMP_CTRL1, (vec >>  0) & 0xFF, ac->i2cmap[i]);
-		ac10x_write(I2S_TX1_CHMP_CTRL2, (vec >>  8) & 0xFF, ac->i2cmap[i]);
-		ac10x_write(I2S_TX1_CHMP_CTRL3, (vec >> 16) & 0xFF, ac->i2cmap[i]);
-		ac10x_write(I2S_TX1_CHMP_CTRL4, (vec >> 24) & 0xFF, ac->i2cmap[i]);
+		chmp[0] = (map[i].chmap >>  0) & 0xFF;
+		chmp[1] = (map[i].chmap >>  8) & 0xFF;
+		chmp[2] = (map[i].chmap >> 16) & 0xFF;
+		chmp[3] = (map[i].chmap >> 24) & 0xFF;
+
+		/* one auto-increment I2C write per register block */
+		r |= ac10x_bulk_write(I2S_TX1_CTRL1, ctrl, ARRAY_SIZE(ctrl), ac->i2cmap[i]);
+		r |= ac10x_bulk_write(I2S_TX1_CHMP_CTRL1, chmp, ARRAY_SIZE(chmp), ac->i2cmap[i]);
 	}
-	return 0;
+	if (r) {
+		pr_err("%s() error, slots %d\n", __func__, slots);
+	}
+	return r;
 }
 
-static int ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params, struct snd_soc_dai *dai) {
+static int __ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params, struct snd_soc_dai *dai) {
 	unsigned int i, channels, samp_res, rate;
 	struct snd_soc_codec *codec = dai->codec;
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
@@ -655,6 +704,9 @@ static int ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_h
 			snd_pcm_stream_str(substream),
 			dai->playback_active, dai->capture_active);
 
+	/* a pll_idle left from the last STOP would gate the clocks set up below */
+	cancel_delayed_work_sync(&ac10x->pll_idle);
+
 	if (ac10x->i2c101) {
 		ret = ac101_hw_params(substream, params, dai);
 		if (ret > 0) {
@@ -714,6 +766,16 @@ static int ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_h
 		return -EINVAL;
 	}
 
+	ac10x->lrck_rate = ac108_sample_rate[rate].real_val;
+
+	if (ac10x->clk_cached
+	 && ac10x->clk_rate == ac10x->lrck_rate
+	 && ac10x->clk_channels == channels
+	 && ac10x->clk_samp_res == samp_res) {
+		dev_dbg(dai->dev, "clock tree unchanged, skip it\n");
+		goto __mod_clk;
+	}
+
 	dev_dbg(dai->dev, "rate: %d , channels: %d , samp_res: %d",
 			ac108_sample_rate[rate].real_val,
 			channels,
@@ -794,10 +856,17 @@ static int ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_h
 	 */
 	ac108_multi_chips_slots(ac10x, channels);
 
+	ac10x->clk_rate = ac10x->lrck_rate;
+	ac10x->clk_channels = channels;
+	ac10x->clk_samp_res = samp_res;
+	ac10x->clk_cached = 1;
+
+__mod_clk:
+	/* still on if pll_idle has not run yet, then regcache saves the bus access */
 	/*0x21: Module clock enable<I2S, ADC digital, MIC offset Calibration, ADC analog>*/
-	ac108_multi_write(MOD_CLK_EN, 1 << I2S | 1 << ADC_DIGITAL | 1 << MIC_OFFSET_CALIBRATION | 1 << ADC_ANALOG, ac10x);
+	ac108_multi_update_bits(MOD_CLK_EN, 0xFF, 1 << I2S | 1 << ADC_DIGITAL | 1 << MIC_OFFSET_CALIBRATION | 1 << ADC_ANALOG, ac10x);
 	/*0x22: Module reset de-asserted<I2S, ADC digital, MIC offset Calibration, ADC analog>*/
-	ac108_multi_write(MOD_RST_CTRL, 1 << I2S | 1 << ADC_DIGITAL | 1 << MIC_OFFSET_CALIBRATION | 1 << ADC_ANALOG, ac10x);
+	ac108_multi_update_bits(MOD_RST_CTRL, 0xFF, 1 << I2S | 1 << ADC_DIGITAL | 1 << MIC_OFFSET_CALIBRATION | 1 << ADC_ANALOG, ac10x);
 
 
 	dev_dbg(dai->dev, "%s() stream=%s ---\n", __func__,
@@ -806,6 +875,14 @@ static int ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_h
 	return 0;
 }
 
+static int ac108_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params, struct snd_soc_dai *dai) {
+	int path = ac10x_prof_enter(AC10X_PATH_HW_PARAMS), ret;
+
+	ret = __ac108_hw_params(substream, params, dai);
+	ac10x_prof_leave(path);
+	return ret;
+}
+
 static int ac108_set_sysclk(struct snd_soc_dai *dai, int clk_id, unsigned int freq, int dir) {
 
 	struct ac10x_priv *ac10x = snd_soc_dai_get_drvdata(dai);
@@ -825,6 +902,9 @@ static int ac108_set_sysclk(struct snd_soc_dai *dai, int clk_id, unsigned int fr
 	default:
 		return -EINVAL;
 	}
+	if (ac10x->sysclk != freq || ac10x->clk_id != clk_id) {
+		ac10x->clk_cached = 0;
+	}
 	ac10x->sysclk = freq;
 	ac10x->clk_id = clk_id;
 
@@ -977,6 +1057,8 @@ static int ac108_set_fmt(struct snd_soc_dai *dai, unsigned int fmt) {
 						0x00 << TX_MLS | 0x03 << SEXT  | 0x00 << LRCK_WIDTH | 0x00 << TX_PDM, ac10x);
 
 	ac108_multi_write(HPF_EN, 0x00, ac10x);
+	/* LRCK period and HPF_EN are rewritten by the next hw_params() */
+	ac10x->clk_cached = 0;
 
 	if (ac10x->i2c101) {
 		return ac101_set_dai_fmt(dai, fmt);
@@ -986,36 +1068,77 @@ static int ac108_set_fmt(struct snd_soc_dai *dai, unsigned int fmt) {
 
 /*
  * due to miss channels order in cpu_dai, we meed defer the clock starting.
+ *
+ * PREPARE powers the PLLs up in advance, their lock time is off the start path.
+ * START is left with one I2S_CTRL write per chip, the master one last:
+ * it opens LRCK, so every chip sees the same first frame edge.
  */
-static int ac108_set_clock(int y_start_n_stop) {
-	u8 reg;
-	int ret = 0;
+static int __ac108_set_clock(int cmd) {
+	ktime_t t_first = ktime_set(0, 0), t_last = ktime_set(0, 0);
+	int i, ret = 0;
+	u8 reg, mask;
 
-	dev_dbg(ac10x->codec->dev, "%s() L%d cmd:%d\n", __func__, __LINE__, y_start_n_stop);
+	dev_dbg(ac10x->codec->dev, "%s() L%d cmd:%d\n", __func__, __LINE__, cmd);
 
 	/* spin_lock move to machine trigger */
 
-	if (y_start_n_stop && ac10x->sysclk_en == 0) {
-		/* enable lrck clock */
-		ac10x_read(I2S_CTRL, &reg, ac10x->i2cmap[_MASTER_INDEX]);
-		if (reg & (0x01 << BCLK_IOEN)) {
-			ret = ret || ac10x_update_bits(I2S_CTRL, 0x03 << LRCK_IOEN, 0x03 << LRCK_IOEN, ac10x->i2cmap[_MASTER_INDEX]);
-		}
+	if (cmd != SEEED_CLOCK_STOP) {
+		/* PLL in use again, no bus access below if it is still on */
+		cancel_delayed_work_sync(&ac10x->pll_idle);
+	}
 
+	if (cmd == SEEED_CLOCK_PREPARE) {
+		/* all three cached if pll_idle has not run, else undo it */
+		/*0x21: Module clock enable<I2S, ADC digital, MIC offset Calibration, ADC analog>*/
+		ret = ret || ac108_multi_update_bits(MOD_CLK_EN, 0xFF, 1 << I2S | 1 << ADC_DIGITAL | 1 << MIC_OFFSET_CALIBRATION | 1 << ADC_ANALOG, ac10x);
+		/*0x22: Module reset de-asserted<I2S, ADC digital, MIC offset Calibration, ADC analog>*/
+		ret = ret || ac108_multi_update_bits(MOD_RST_CTRL, 0xFF, 1 << I2S | 1 << ADC_DIGITAL | 1 << MIC_OFFSET_CALIBRATION | 1 << ADC_ANALOG, ac10x);
 		/*0x10: PLL Common voltage enable, PLL enable */
 		ret = ret || ac108_multi_update_bits(PLL_CTRL1, 0x01 << PLL_EN | 0x01 << PLL_COM_EN,
 						   0x01 << PLL_EN | 0x01 << PLL_COM_EN, ac10x);
-		/* enable global clock */
-		ret = ret || ac108_multi_update_bits(I2S_CTRL, 0x1 << TXEN | 0x1 << GEN, 0x1 << TXEN | 0x1 << GEN, ac10x);
+		return ret;
+	}
+
+	if (cmd == SEEED_CLOCK_START && ac10x->sysclk_en == 0) {
+		/* no bus access if prepared, regcache has it */
+		ret = ret || ac108_multi_update_bits(PLL_CTRL1, 0x01 << PLL_EN | 0x01 << PLL_COM_EN,
+						   0x01 << PLL_EN | 0x01 << PLL_COM_EN, ac10x);
+
+		/* enable global clock, slave chips first */
+		for (i = ac10x->codec_cnt - 1; i >= 0; i--) {
+			mask = 0x1 << TXEN | 0x1 << GEN;
+			if (i == _MASTER_INDEX) {
+				/* enable lrck clock */
+				ac10x_read(I2S_CTRL, &reg, ac10x->i2cmap[_MASTER_INDEX]);
+				if (reg & (0x01 << BCLK_IOEN)) {
+					mask |= 0x03 << LRCK_IOEN;
+				}
+			}
+			ret = ret || ac10x_update_bits(I2S_CTRL, mask, mask, ac10x->i2cmap[i]);
+			t_last = ktime_get();
+			if (i == ac10x->codec_cnt - 1) {
+				t_first = t_last;
+			}
+		}
+
+		ac10x->trig_skew_ns = ktime_to_ns(ktime_sub(t_last, t_first));
+		if (ac10x->codec_cnt < 2 || (mask & (0x01 << LRCK_IOEN))) {
+			/* LRCK held until every chip enabled */
+			ac10x->trig_skew_frames = 0;
+		} else {
+			ac10x->trig_skew_frames = div_u64((u64)ac10x->trig_skew_ns * ac10x->lrck_rate
+						+ NSEC_PER_SEC - 1, NSEC_PER_SEC);
+		}
+		dev_dbg(ac10x->codec->dev, "codecs start skew %lld ns, %u frames\n",
+			ac10x->trig_skew_ns, ac10x->trig_skew_frames);
 
 		ac10x->sysclk_en = 1UL;
-	} else if (!y_start_n_stop && ac10x->sysclk_en != 0) {
+	} else if (cmd == SEEED_CLOCK_STOP && ac10x->sysclk_en != 0) {
 		/* disable global clock */
 		ret = ret || ac108_multi_update_bits(I2S_CTRL, 0x1 << TXEN | 0x1 << GEN, 0x0 << TXEN | 0x0 << GEN, ac10x);
 
-		/*0x10: PLL Common voltage disable, PLL disable */
-		ret = ret || ac108_multi_update_bits(PLL_CTRL1, 0x01 << PLL_EN | 0x01 << PLL_COM_EN,
-						   0x00 << PLL_EN | 0x00 << PLL_COM_EN, ac10x);
+		/* PLL is left running for a quick restart, see ac108_pll_idle() */
+		mod_delayed_work(system_wq, &ac10x->pll_idle, msecs_to_jiffies(pll_idle_ms));
 
 		/* disable lrck clock if it's enabled */
 		ac10x_read(I2S_CTRL, &reg, ac10x->i2cmap[_MASTER_INDEX]);
@@ -1030,6 +1153,35 @@ static int ac108_set_clock(int y_start_n_stop) {
 	return ret;
 }
 
+static int ac108_set_clock(int cmd) {
+	int path = ac10x_prof_enter(AC10X_PATH_SET_CLOCK), ret;
+
+	ret = __ac108_set_clock(cmd);
+	ac10x_prof_leave(path);
+	return ret;
+}
+
+/*
+ * pll_idle_ms after the last STOP without a new PREPARE/START,
+ * gate the module clocks and power the PLL down.
+ */
+static void ac108_pll_idle(struct work_struct *work) {
+	struct ac10x_priv *ac10x = container_of(work, struct ac10x_priv, pll_idle.work);
+
+	if (ac10x->sysclk_en) {
+		return;
+	}
+
+	/*0x21: Module clock disable <I2S, ADC digital, MIC offset Calibration, ADC analog>*/
+	ac108_multi_write(MOD_CLK_EN, 0x0, ac10x);
+	/*0x22: Module reset asserted <I2S, ADC digital, MIC offset Calibration, ADC analog>*/
+	ac108_multi_write(MOD_RST_CTRL, 0x0, ac10x);
+
+	/*0x10: PLL Common voltage disable, PLL disable */
+	ac108_multi_update_bits(PLL_CTRL1, 0x01 << PLL_EN | 0x01 << PLL_COM_EN,
+					   0x00 << PLL_EN | 0x00 << PLL_COM_EN, ac10x);
+}
+
 static int ac108_prepare(struct snd_pcm_substream *substream,
 					struct snd_soc_dai *dai)
 {
@@ -1040,7 +1192,7 @@ static int ac108_prepare(struct snd_pcm_substream *substream,
 	return 0;
 }
 
-static int ac108_trigger(struct snd_pcm_substream *substream, int cmd,
+static int __ac108_trigger(struct snd_pcm_substream *substream, int cmd,
 			     struct snd_soc_dai *dai)
 {
 	struct snd_soc_codec *codec = dai->codec;
@@ -1090,6 +1242,16 @@ __ret:
 	return ret;
 }
 
+static int ac108_trigger(struct snd_pcm_substream *substream, int cmd,
+			     struct snd_soc_dai *dai)
+{
+	int path = ac10x_prof_enter(AC10X_PATH_TRIGGER), ret;
+
+	ret = __ac108_trigger(substream, cmd, dai);
+	ac10x_prof_leave(path);
+	return ret;
+}
+
 int ac108_audio_startup(struct snd_pcm_substream *substream,
 	struct snd_soc_dai *dai
 ) {
@@ -1108,11 +1270,9 @@ void ac108_aif_shutdown(struct snd_pcm_substream *substream,
 	struct snd_soc_codec *codec = dai->codec;
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
 
-	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE) {
-		/*0x21: Module clock disable <I2S, ADC digital, MIC offset Calibration, ADC analog>*/
-		ac108_multi_write(MOD_CLK_EN, 0x0, ac10x);
-		/*0x22: Module reset asserted <I2S, ADC digital, MIC offset Calibration, ADC analog>*/
-		ac108_multi_write(MOD_RST_CTRL, 0x0, ac10x);
+	/* capture module clocks are gated by ac108_pll_idle(), hw_params may have cancelled it */
+	if (!ac10x->sysclk_en) {
+		mod_delayed_work(system_wq, &ac10x->pll_idle, msecs_to_jiffies(pll_idle_ms));
 	}
 
 	if (ac10x->i2c101) {
@@ -1229,7 +1389,7 @@ static int ac108_codec_probe(struct snd_soc_codec *codec) {
 	return 0;
 }
 
-static int ac108_set_bias_level(struct snd_soc_codec *codec, enum snd_soc_bias_level level) {
+static int __ac108_set_bias_level(struct snd_soc_codec *codec, enum snd_soc_bias_level level) {
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
 
 	dev_dbg(codec->dev, "AC108 level:%d\n", level);
@@ -1263,6 +1423,14 @@ static int ac108_set_bias_level(struct snd_soc_codec *codec, enum snd_soc_bias_l
 	return 0;
 }
 
+static int ac108_set_bias_level(struct snd_soc_codec *codec, enum snd_soc_bias_level level) {
+	int path = ac10x_prof_enter(AC10X_PATH_BIAS), ret;
+
+	ret = __ac108_set_bias_level(codec, level);
+	ac10x_prof_leave(path);
+	return ret;
+}
+
 int ac108_codec_remove(struct snd_soc_codec *codec) {
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
 
@@ -1282,6 +1450,11 @@ int ac108_codec_suspend(struct snd_soc_codec *codec) {
 	struct ac10x_priv *ac10x = snd_soc_codec_get_drvdata(codec);
 	int i;
 
+	if (cancel_delayed_work_sync(&ac10x->pll_idle)) {
+		ac108_pll_idle(&ac10x->pll_idle.work);
+	}
+	ac10x->clk_cached = 0;
+
 	for (i = 0; i < ac10x->codec_cnt; i++) {
 		regcache_cache_only(ac10x->i2cmap[i], true);
 	}
@@ -1383,9 +1556,16 @@ static ssize_t ac108_show(struct device *dev, struct device_attribute *attr, cha
 #endif
 }
 
+static ssize_t ac108_trigger_skew_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	return snprintf(buf, PAGE_SIZE, "%lld ns, %u frames\n",
+			ac10x->trig_skew_ns, ac10x->trig_skew_frames);
+}
+
 static DEVICE_ATTR(ac108, 0644, ac108_show, ac108_store);
+static DEVICE_ATTR(trigger_skew, 0444, ac108_trigger_skew_show, NULL);
 static struct attribute *ac108_debug_attrs[] = {
 	&dev_attr_ac108.attr,
+	&dev_attr_trigger_skew.attr,
 	NULL,
 };
 static struct attribute_group ac108_debug_attr_group = {
@@ -1411,6 +1591,8 @@ static int ac108_i2c_probe(struct i2c_client *i2c, const struct i2c_device_id *i
 			dev_err(&i2c->dev, "Unable to allocate ac10x private data\n");
 			return -ENOMEM;
 		}
+		INIT_DELAYED_WORK(&ac10x->pll_idle, ac108_pll_idle);
+		ac10x_prof_init();
 	}
 
 	index = (int)i2c_id->driver_data;
@@ -1453,6 +1635,7 @@ static int ac108_i2c_probe(struct i2c_client *i2c, const struct i2c_device_id *i
 	regcache_cache_only(ac10x->i2cmap[index], false);
 	ret = regmap_write(ac10x->i2cmap[index], CHIP_RST, CHIP_RST_VAL);
 	msleep(1);
+	ac10x->clk_cached = 0;
 
 	/* sync regcache for FLAT type */
 	ac10x_fill_regcache(&i2c->dev, ac10x->i2cmap[index]);
@@ -1469,7 +1652,8 @@ __ret:
 	/* It's time to bind codec to i2c[_MASTER_INDEX] when all i2c are ready */
 	if ((ac10x->codec_cnt != 0 && ac10x->tdm_chips_cnt < 2)
 	|| (ac10x->i2c[0] && ac10x->i2c[1] && ac10x->i2c101)) {
-		seeed_voice_card_register_set_clock(SNDRV_PCM_STREAM_CAPTURE, ac108_set_clock);
+		seeed_voice_card_register_set_clock(&ac10x->i2c[_MASTER_INDEX]->dev,
+						    SNDRV_PCM_STREAM_CAPTURE, ac108_set_clock);
 		/* no playback stream */
 		if (! ac10x->i2c101) {
 			memset(&ac108_dai[_MASTER_INDEX]->playback, '\0', sizeof ac108_dai[_MASTER_INDEX]->playback);
@@ -1484,6 +1668,13 @@ __ret:
 }
 
 static int ac108_i2c_remove(struct i2c_client *i2c) {
+	/* it touches every chip, no more once one of them goes */
+	cancel_delayed_work_sync(&ac10x->pll_idle);
+
+	if (ac10x->i2c[_MASTER_INDEX]) {
+		seeed_voice_card_unregister_set_clock(&ac10x->i2c[_MASTER_INDEX]->dev);
+	}
+
 	if (ac10x->codec != NULL) {
 		snd_soc_unregister_codec(&ac10x->i2c[_MASTER_INDEX]->dev);
 		ac10x->codec = NULL;
@@ -1505,6 +1696,7 @@ static int ac108_i2c_remove(struct i2c_client *i2c) {
 
 __ret:
 	if (!ac10x->i2c[0] && !ac10x->i2c[1] && !ac10x->i2c101) {
+		ac10x_prof_release();
 		kfree(ac10x);
 		ac10x = NULL;
 	}
@@ -0,0 +1,298 @@
+/*
+ * beamform.c -- fixed-point delay-and-sum beamformer with GCC-PHAT DOA
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Per-sample work (delay lines, sum, FFT, PHAT weighting) is integer only,
+ * laid out as plain loops over contiguous buffers for the compiler to
+ * vectorise. Floating point is used once per DOA window, for the angle.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "beamform.h"
+
+#define SOUND_SPEED		343.0		/* m/s */
+#define BF_GATE			(1 << 20)	/* about -61 dBFS, keep last DOA below */
+
+static void bf_steer(struct bf_state *bf) {
+	double t[BF_MICS_MAX], tmax = -1.0;
+	double theta = bf->doa * M_PI / 180.0;
+	int i;
+
+	/* arrival time relative to the array center, earlier is smaller */
+	for (i = 0; i < bf->mics; i++) {
+		t[i] = -bf->radius * cos(theta - 2 * M_PI * i / bf->mics) / SOUND_SPEED;
+		if (t[i] > tmax)
+			tmax = t[i];
+	}
+	/* delay every mic up to the latest arrival */
+	for (i = 0; i < bf->mics; i++) {
+		bf->delay[i] = lround((tmax - t[i]) * bf->rate);
+	}
+}
+
+void bf_reset(struct bf_state *bf) {
+	int i;
+
+	for (i = 0; i < bf->mics; i++) {
+		memset(bf->line[i], 0, (BF_DELAY_MAX + BF_CHUNK) * sizeof(int32_t));
+	}
+	bf->win_fill = 0;
+	bf->doa = 0.0;
+	bf_steer(bf);
+}
+
+void bf_free(struct bf_state *bf) {
+	int i;
+
+	for (i = 0; i < BF_MICS_MAX; i++) {
+		free(bf->line[i]);
+		free(bf->win[i]);
+		bf->line[i] = bf->win[i] = NULL;
+	}
+	for (i = 0; i < BF_MICS_MAX + 1; i++) {
+		free(bf->re[i]);
+		free(bf->im[i]);
+		bf->re[i] = bf->im[i] = NULL;
+	}
+}
+
+int bf_init(struct bf_state *bf, int mics, unsigned rate, double radius) {
+	double max_delay;
+	int i;
+
+	memset(bf, 0, sizeof *bf);
+	if (mics < 2 || mics > BF_MICS_MAX || (mics & 1) || !rate || radius <= 0.0)
+		return -EINVAL;
+
+	max_delay = 2 * radius * rate / SOUND_SPEED;
+	if (max_delay >= BF_DELAY_MAX)
+		return -EINVAL;
+
+	bf->mics = mics;
+	bf->rate = rate;
+	bf->radius = radius;
+	bf->max_lag = (int)ceil(max_delay) + 1;
+	bf->gain_q12 = (8 << 12) / mics;
+
+	for (i = 0; i < BF_FFT_SIZE / 2; i++) {
+		bf->tw_re[i] = lround( cos(2 * M_PI * i / BF_FFT_SIZE) * 32767);
+		bf->tw_im[i] = lround(-sin(2 * M_PI * i / BF_FFT_SIZE) * 32767);
+	}
+
+	for (i = 0; i < mics; i++) {
+		bf->line[i] = calloc(BF_DELAY_MAX + BF_CHUNK, sizeof(int32_t));
+		bf->win[i]  = calloc(BF_WIN_SIZE, sizeof(int32_t));
+		if (!bf->line[i] || !bf->win[i])
+			goto nomem;
+	}
+	for (i = 0; i < mics + 1; i++) {
+		bf->re[i] = calloc(BF_FFT_SIZE, sizeof(int32_t));
+		bf->im[i] = calloc(BF_FFT_SIZE, sizeof(int32_t));
+		if (!bf->re[i] || !bf->im[i])
+			goto nomem;
+	}
+
+	bf_reset(bf);
+	return 0;
+
+nomem:
+	bf_free(bf);
+	return -ENOMEM;
+}
+
+/*
+ * In place radix-2 FFT, Q15 twiddles, scaled by 1/2 each stage.
+ * Components must stay within +/-2^14.
+ */
+static void bf_fft(const struct bf_state *bf, int32_t *re, int32_t *im) {
+	int32_t tr, ti;
+	int i, j, k, bit, len, half, step;
+
+	for (i = 1, j = 0; i < BF_FFT_SIZE; i++) {
+		for (bit = BF_FFT_SIZE >> 1; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			tr = re[i]; re[i] = re[j]; re[j] = tr;
+			ti = im[i]; im[i] = im[j]; im[j] = ti;
+		}
+	}
+
+	for (len = 2; len <= BF_FFT_SIZE; len <<= 1) {
+		half = len >> 1;
+		step = BF_FFT_SIZE / len;
+		for (i = 0; i < BF_FFT_SIZE; i += len) {
+			int32_t *ar = re + i, *ai = im + i;
+			int32_t *br = ar + half, *bi = ai + half;
+
+			for (k = 0; k < half; k++) {
+				int32_t wr = bf->tw_re[k * step], wi = bf->tw_im[k * step];
+
+				tr = (br[k] * wr - bi[k] * wi) >> 15;
+				ti = (br[k] * wi + bi[k] * wr) >> 15;
+				br[k] = (ar[k] - tr) >> 1;
+				bi[k] = (ai[k] - ti) >> 1;
+				ar[k] = (ar[k] + tr) >> 1;
+				ai[k] = (ai[k] + ti) >> 1;
+			}
+		}
+	}
+}
+
+/* lag of mic a behind mic b, in frames, sub-sample by parabolic fit */
+static double bf_gcc_phat(struct bf_state *bf, int a, int b) {
+	int32_t *xr = bf->re[bf->mics], *xi = bf->im[bf->mics];
+	int32_t y0, y1, y2, best;
+	double delta = 0.0;
+	int k, lag, best_lag = 0;
+
+	for (k = 0; k < BF_FFT_SIZE; k++) {
+		int32_t cr = bf->re[a][k] * bf->re[b][k] + bf->im[a][k] * bf->im[b][k];
+		int32_t ci = bf->im[a][k] * bf->re[b][k] - bf->re[a][k] * bf->im[b][k];
+		uint32_t ar = abs(cr), ai = abs(ci);
+		/* |c| ~ 15/16 max + 15/32 min */
+		uint32_t mag = ar > ai ? ar - (ar >> 4) + (ai >> 1) - (ai >> 5)
+				       : ai - (ai >> 4) + (ar >> 1) - (ar >> 5);
+
+		if (mag == 0) {
+			xr[k] = xi[k] = 0;
+			continue;
+		}
+		/* PHAT weighting, Q12; conjugated, forward FFT then gives the inverse */
+		xr[k] =  (int32_t)(((int64_t)cr << 12) / mag);
+		xi[k] = -(int32_t)(((int64_t)ci << 12) / mag);
+	}
+	bf_fft(bf, xr, xi);
+
+	best = xr[0];
+	for (lag = -bf->max_lag; lag <= bf->max_lag; lag++) {
+		if (xr[lag & (BF_FFT_SIZE - 1)] > best) {
+			best = xr[lag & (BF_FFT_SIZE - 1)];
+			best_lag = lag;
+		}
+	}
+
+	y0 = xr[(best_lag - 1) & (BF_FFT_SIZE - 1)];
+	y1 = best;
+	y2 = xr[(best_lag + 1) & (BF_FFT_SIZE - 1)];
+	if (y0 - 2 * y1 + y2 != 0) {
+		delta = 0.5 * (y0 - y2) / (y0 - 2 * y1 + y2);
+		if (delta > 0.5) delta = 0.5;
+		if (delta < -0.5) delta = -0.5;
+	}
+	return best_lag + delta;
+}
+
+static void bf_estimate(struct bf_state *bf) {
+	int pairs = bf->mics / 2;
+	double sx = 0.0, sy = 0.0, tau, alpha;
+	uint32_t peak = 0, a;
+	int i, k, sh;
+
+	for (i = 0; i < bf->mics; i++) {
+		for (k = 0; k < BF_WIN_SIZE; k++) {
+			a = bf->win[i][k] < 0 ? -(uint32_t)bf->win[i][k] : (uint32_t)bf->win[i][k];
+			if (a > peak)
+				peak = a;
+		}
+	}
+	if (peak < BF_GATE)
+		return;
+
+	/* block floating point, the loudest sample just below 2^14 */
+	for (sh = 0; (peak >> sh) >= (1U << 14); sh++);
+
+	for (i = 0; i < bf->mics; i++) {
+		for (k = 0; k < BF_WIN_SIZE; k++) {
+			bf->re[i][k] = bf->win[i][k] >> sh;
+		}
+		memset(bf->re[i] + BF_WIN_SIZE, 0, (BF_FFT_SIZE - BF_WIN_SIZE) * sizeof(int32_t));
+		memset(bf->im[i], 0, BF_FFT_SIZE * sizeof(int32_t));
+		bf_fft(bf, bf->re[i], bf->im[i]);
+	}
+
+	/*
+	 * opposite mics i, i + mics/2, on axis alpha:
+	 * tau = -2 * radius * rate * cos(theta - alpha) / c
+	 */
+	for (i = 0; i < pairs; i++) {
+		tau = bf_gcc_phat(bf, i, i + pairs);
+		alpha = 2 * M_PI * i / bf->mics;
+		sx -= tau * cos(alpha);
+		sy -= tau * sin(alpha);
+	}
+
+	bf->doa = atan2(sy, sx) * 180.0 / M_PI;
+	if (bf->doa < 0.0)
+		bf->doa += 360.0;
+	if (bf->doa >= 360.0)
+		bf->doa -= 360.0;
+	bf_steer(bf);
+}
+
+void bf_process(struct bf_state *bf, const int32_t *const *in, int in_step,
+		int32_t *out, int32_t *doa, int out_step, unsigned frames) {
+	unsigned done, n, k, w;
+	int32_t doa_val;
+	int i;
+
+	for (done = 0; done < frames; done += n) {
+		n = frames - done;
+		if (n > BF_CHUNK)
+			n = BF_CHUNK;
+
+		/* de-interleave into the delay lines */
+		for (i = 0; i < bf->mics; i++) {
+			const int32_t *src = in[i] + (long)done * in_step;
+			int32_t *l = bf->line[i] + BF_DELAY_MAX;
+
+			for (k = 0; k < n; k++) {
+				l[k] = src[k * in_step];
+			}
+		}
+
+		/* delay and sum, 1/8 headroom for up to 8 mics */
+		memset(bf->acc, 0, n * sizeof(int32_t));
+		for (i = 0; i < bf->mics; i++) {
+			const int32_t *l = bf->line[i] + BF_DELAY_MAX - bf->delay[i];
+
+			for (k = 0; k < n; k++) {
+				bf->acc[k] += l[k] >> 3;
+			}
+		}
+
+		doa_val = (int32_t)(bf->doa * (1 << BF_DOA_SHIFT));
+		for (k = 0; k < n; k++) {
+			out[(done + k) * out_step] = (int32_t)(((int64_t)bf->acc[k] * bf->gain_q12) >> 12);
+		}
+		if (doa) {
+			for (k = 0; k < n; k++) {
+				doa[(done + k) * out_step] = doa_val;
+			}
+		}
+
+		/* DOA window, estimation retunes the steering for the next chunk */
+		for (k = 0; k < n; k += w) {
+			w = BF_WIN_SIZE - bf->win_fill;
+			if (w > n - k)
+				w = n - k;
+			for (i = 0; i < bf->mics; i++) {
+				memcpy(bf->win[i] + bf->win_fill, bf->line[i] + BF_DELAY_MAX + k,
+				       w * sizeof(int32_t));
+			}
+			bf->win_fill += w;
+			if (bf->win_fill == BF_WIN_SIZE) {
+				bf_estimate(bf);
+				bf->win_fill = 0;
+			}
+		}
+
+		for (i = 0; i < bf->mics; i++) {
+			memmove(bf->line[i], bf->line[i] + n, BF_DELAY_MAX * sizeof(int32_t));
+		}
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ * beamform.h -- fixed-point delay-and-sum beamformer with GCC-PHAT DOA
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * For circular arrays with an even mic count, channel i at angle 360 * i / mics.
+ */
+#ifndef __BEAMFORM_H__
+#define __BEAMFORM_H__
+
+#include <stdint.h>
+
+#define BF_MICS_MAX		8
+#define BF_WIN_SIZE		256		/* frames per DOA estimation */
+#define BF_FFT_BITS		9		/* window zero padded to 512 */
+#define BF_FFT_SIZE		(1 << BF_FFT_BITS)
+#define BF_DELAY_MAX		64		/* steering delay, frames */
+#define BF_CHUNK		256		/* frames per delay-and-sum pass */
+
+/* DOA side channel sample: degree in Q16, [0, 360) */
+#define BF_DOA_SHIFT		16
+
+struct bf_state {
+	int mics;
+	unsigned rate;
+	double radius;				/* meter */
+	int max_lag;				/* frames, GCC-PHAT search range */
+
+	/* delay-and-sum */
+	int delay[BF_MICS_MAX];
+	int32_t gain_q12;			/* 8 / mics, Q12 */
+	int32_t *line[BF_MICS_MAX];		/* BF_DELAY_MAX history + BF_CHUNK */
+	int32_t acc[BF_CHUNK];
+
+	/* DOA */
+	int32_t *win[BF_MICS_MAX];		/* BF_WIN_SIZE frames */
+	int win_fill;
+	int16_t tw_re[BF_FFT_SIZE / 2];		/* exp(-j 2 pi k / N), Q15 */
+	int16_t tw_im[BF_FFT_SIZE / 2];
+	int32_t *re[BF_MICS_MAX + 1];		/* spectrum, BF_FFT_SIZE, last one scratch */
+	int32_t *im[BF_MICS_MAX + 1];
+	double doa;				/* degree */
+};
+
+/* radius in meter; return 0 or -errno */
+int bf_init(struct bf_state *bf, int mics, unsigned rate, double radius);
+void bf_free(struct bf_state *bf);
+void bf_reset(struct bf_state *bf);
+
+/*
+ * in[i]: mic i, in_step samples apart.
+ * out: beam, doa: DOA side channel or NULL, both out_step samples apart.
+ */
+void bf_process(struct bf_state *bf, const int32_t *const *in, int in_step,
+		int32_t *out, int32_t *doa, int out_step, unsigned frames);
+
+#endif//__BEAMFORM_H__
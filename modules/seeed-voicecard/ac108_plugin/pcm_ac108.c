@@ -9,25 +9,117 @@
 #include <math.h>
 
 #define ARRAY_SIZE(ary)	(sizeof(ary)/sizeof(ary[0]))
-#define  AC108_FRAME_SIZE 40960
+/* a plugin frame is 2 slave frames of 2 channels, at twice the rate */
+#define AC108_SLAVE_CHANNELS	2
+#define AC108_CHANNELS		4
 struct ac108_t {
 	snd_pcm_ioplug_t io;
 	snd_pcm_t *pcm;
 	snd_pcm_hw_params_t *hw_params;
-	unsigned int last_size;
-	unsigned int ptr;
 	unsigned int        latency;         // Delay in usec
 	unsigned int        bufferSize;      // Size of sample buffer
+	unsigned char *buf;                  // one period of slave frames
+	snd_pcm_uframes_t buf_frames;        // in plugin frames
+	int32_t gain;                        // Q16, integer formats
+	float gain_f;                        // FLOAT, full scale folded in
 };
-static unsigned char capture_buf[AC108_FRAME_SIZE];
-/* set up the fixed parameters of pcm PCM hw_parmas */
+
+#define AC108_GAIN_UNITY	0x10000		/* Q16 */
+
+/*
+ * Sample conversion, S32 slave samples to the client format, in the pass
+ * which drops the unused channels. The loops are plain enough for
+ * the compiler to vectorize, all 4 channels taken is one flat loop.
+ */
+static inline int32_t ac108_gain(int32_t v, int32_t g) {
+	int64_t x = ((int64_t)v * g) >> 16;
+
+	return x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : (int32_t)x;
+}
+
+#define TO_S32(d, i, v)		((d)[i] = (v))
+#define TO_S32_G(d, i, v)	((d)[i] = ac108_gain((v), g))
+#define TO_S16(d, i, v)		((d)[i] = (int16_t)((v) >> 16))
+#define TO_S16_G(d, i, v)	((d)[i] = (int16_t)(ac108_gain((v), g) >> 16))
+#define TO_S24_3LE(d, i, v)	do { int32_t _v = (v) >> 8; \
+		(d)[3 * (i)] = _v; (d)[3 * (i) + 1] = _v >> 8; (d)[3 * (i) + 2] = _v >> 16; } while (0)
+#define TO_S24_3LE_G(d, i, v)	TO_S24_3LE(d, i, ac108_gain((v), g))
+#define TO_FLOAT(d, i, v)	((d)[i] = (float)(v) * gf)
+
+/* n frames of AC108_CHANNELS samples at s to ch interleaved samples at d */
+#define AC108_CONVERT(d, s, n, ch, CONV) do {				\
+	snd_pcm_uframes_t _k;						\
+	unsigned int _c;						\
+	if ((ch) == AC108_CHANNELS) {					\
+		for (_k = 0; _k < (n) * AC108_CHANNELS; _k++)		\
+			CONV(d, _k, (s)[_k]);				\
+	} else {							\
+		for (_k = 0; _k < (n); _k++)				\
+			for (_c = 0; _c < (ch); _c++)			\
+				CONV(d, _k * (ch) + _c, (s)[_k * AC108_CHANNELS + _c]); \
+	}								\
+} while (0)
+
+static void ac108_convert(const struct ac108_t *capture, snd_pcm_format_t format,
+						  void *dst, const int32_t *restrict s,
+						  snd_pcm_uframes_t n, unsigned int ch) {
+	const int32_t g = capture->gain;
+	const float gf = capture->gain_f;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16: {
+		int16_t *restrict d = dst;
+		if (g == AC108_GAIN_UNITY)
+			AC108_CONVERT(d, s, n, ch, TO_S16);
+		else
+			AC108_CONVERT(d, s, n, ch, TO_S16_G);
+		break;
+	}
+	case SND_PCM_FORMAT_S24_3LE: {
+		uint8_t *restrict d = dst;
+		if (g == AC108_GAIN_UNITY)
+			AC108_CONVERT(d, s, n, ch, TO_S24_3LE);
+		else
+			AC108_CONVERT(d, s, n, ch, TO_S24_3LE_G);
+		break;
+	}
+	case SND_PCM_FORMAT_FLOAT: {
+		float *restrict d = dst;
+		AC108_CONVERT(d, s, n, ch, TO_FLOAT);
+		break;
+	}
+	default: {
+		int32_t *restrict d = dst;
+		if (g == AC108_GAIN_UNITY)
+			AC108_CONVERT(d, s, n, ch, TO_S32);
+		else
+			AC108_CONVERT(d, s, n, ch, TO_S32_G);
+		break;
+	}
+	}
+}
+
+/* base of the areas if they are plain interleaved channels, NULL if not */
+static unsigned char *ac108_interleaved(const snd_pcm_channel_area_t *areas,
+										unsigned int channels, unsigned int width) {
+	unsigned int chn;
+
+	for (chn = 0; chn < channels; chn++) {
+		if (areas[chn].addr != areas[0].addr ||
+			areas[chn].first != areas[0].first + chn * width ||
+			areas[chn].step != channels * width)
+			return NULL;
+	}
+	if (areas[0].first % 8)
+		return NULL;
+	return (unsigned char *)areas[0].addr + areas[0].first / 8;
+}
+/* set up the fixed parameters of pcm PCM hw_parmas, sizes follow the client in ac108_hw_params() */
 static int ac108_slave_hw_params_half(struct ac108_t *capture, unsigned int rate,snd_pcm_format_t format) {
 	int err;
     snd_pcm_uframes_t bufferSize = capture->bufferSize;
     unsigned int latency = capture->latency;
 
-    unsigned int buffer_time = 0;
-    unsigned int period_time = 0;
 	if ((err = snd_pcm_hw_params_malloc(&capture->hw_params)) < 0) return err;
 
 	if ((err = snd_pcm_hw_params_any(capture->pcm, capture->hw_params)) < 0) {
@@ -53,25 +145,6 @@ static int ac108_slave_hw_params_half(struct ac108_t *capture, unsigned int rate
 		goto out;
 	}
 
-    err = snd_pcm_hw_params_get_buffer_time_max(capture->hw_params,
-            &buffer_time, 0);
-    if (buffer_time > 80000)
-        buffer_time = 80000;
-    period_time = buffer_time / 4;
-
-    err = snd_pcm_hw_params_set_period_time_near(capture->pcm, capture->hw_params,
-            &period_time, 0);
-    if (err < 0) {
-        SNDERR("Unable to set_period_time_near");
-        goto out;
-    }
-    err = snd_pcm_hw_params_set_buffer_time_near(capture->pcm, capture->hw_params,
-            &buffer_time, 0);
-    if (err < 0) {
-        SNDERR("Unable to set_buffer_time_near");
-        goto out;
-    }
-
     capture->bufferSize = bufferSize;
     capture->latency = latency;
 
@@ -103,112 +176,103 @@ static int ac108_stop(snd_pcm_ioplug_t *io) {
 /*
  * pointer callback
  *
- * Calculate the current position from the delay of pcm PCM
+ * Every frame the slave has captured is ready to be transferred,
+ * the hardware pointer is that far ahead of the application.
  */
 static snd_pcm_sframes_t ac108_pointer(snd_pcm_ioplug_t *io) {
-
 	struct ac108_t *capture = io->private_data;
-	int  size;
-	
-	assert(capture);
-
+	snd_pcm_sframes_t avail;
 
-	size = snd_pcm_avail(capture->pcm);
-	if (size < 0) 
-		return size;
+	avail = snd_pcm_avail(capture->pcm);
+	if (avail < 0)
+		return avail;
 
-	size = size/2;
-
-	if (size > capture->last_size) {
-			capture->ptr += size - capture->last_size;
-			capture->ptr %= io->buffer_size;
-	}
+	avail /= AC108_CHANNELS / AC108_SLAVE_CHANNELS;
+	if ((snd_pcm_uframes_t)avail > io->buffer_size)
+		return -EPIPE;
 
-	//fprintf(stderr, "%s :%d %d %d %d %d %d\n", __func__,capture->ptr ,capture->last_size,size,  io->buffer_size,io->appl_ptr, io->hw_ptr);
-	capture->last_size = size;
-	
-	return capture->ptr;
+	return (io->appl_ptr + avail) % io->buffer_size;
 }
 
 /*
  * transfer callback
+ *
+ * The slave is non-blocking, only what it already holds is read;
+ * ioplug waits on the poll descriptors for the rest. A slave xrun is
+ * returned as -EPIPE, the application recovers with snd_pcm_prepare().
  */
 static snd_pcm_sframes_t ac108_transfer(snd_pcm_ioplug_t *io,
 										const snd_pcm_channel_area_t *dst_areas,
 										snd_pcm_uframes_t dst_offset,
 										snd_pcm_uframes_t size) {
 	struct ac108_t *capture = io->private_data;
-	int chn;
-	unsigned char *dst_samples[io->channels];
-	int dst_steps[io->channels];
-	int bps = snd_pcm_format_width(io->format) / 8;  /* bytes per sample */
-	int i;
-	int count = 0;	
-	int err = 0;
-	unsigned char *src_buf;
-	unsigned char src_data[4][4];
-
-	
-	memset(capture_buf,0,AC108_FRAME_SIZE);
-
-	if(snd_pcm_avail(capture->pcm) > size*2){
-		if ((err = snd_pcm_readi (capture->pcm, capture_buf, size*2)) != size*2) {
-			SNDERR("read from audio interface failed %ld %d  %s!\n",size,err,snd_strerror (err));
-			exit(EXIT_FAILURE);
-			size = 0 ;
-		}
-	}else{
-		size = 0;
+	unsigned char *dst_samples[AC108_CHANNELS];
+	int dst_steps[AC108_CHANNELS];
+	int width = snd_pcm_format_physical_width(io->format);
+	int bps = width / 8;  /* bytes per sample */
+	snd_pcm_uframes_t count = 0, n, k;
+	snd_pcm_sframes_t avail, got;
+	const int32_t *src_buf;
+	unsigned char *dst;
+	unsigned int chn;
+
+	dst = ac108_interleaved(dst_areas, io->channels, width);
+	if (dst) {
+		dst += dst_offset * io->channels * bps;
 	}
-#if 1	
+
 	/* verify and prepare the contents of areas */
-	for (chn = 0; chn < io->channels; chn++) {
-		if ((dst_areas[chn].first % 8) != 0) {
-			SNDERR("dst_areas[%i].first == %i, aborting...\n", chn, dst_areas[chn].first);
-			exit(EXIT_FAILURE);
-		}
-		dst_samples[chn] = /*(signed short *)*/(((unsigned char *)dst_areas[chn].addr) + (dst_areas[chn].first / 8));
-		if ((dst_areas[chn].step % 16) != 0) {
-			SNDERR("dst_areas[%i].step == %i, aborting...\n", chn, dst_areas[chn].step);
-			exit(EXIT_FAILURE);
+	for (chn = 0; !dst && chn < io->channels; chn++) {
+		if ((dst_areas[chn].first % 8) != 0 || (dst_areas[chn].step % 8) != 0) {
+			SNDERR("dst_areas[%u] first %u step %u not byte aligned",
+				   chn, dst_areas[chn].first, dst_areas[chn].step);
+			return -EINVAL;
 		}
 		dst_steps[chn] = dst_areas[chn].step / 8;
-		dst_samples[chn] += dst_offset * dst_steps[chn];
+		dst_samples[chn] = ((unsigned char *)dst_areas[chn].addr) + (dst_areas[chn].first / 8)
+						 + dst_offset * dst_steps[chn];
 	}
-#endif	
-	//  for(i = 0; i < size*2*bps;i++){
-	// 	fprintf(stderr,"%x ",capture_buf[i]);
-	// 	if(i%4 == 0)
-	// 		fprintf(stderr,"\n");
-	// }
-
-	//generate_sine(dst_areas, dst_offset,size, &count);
-	src_buf = capture_buf;
-#if 1
-	while(count < size){
-		for(chn = 0; chn < 4; chn++){
-			for (i = 0; i < bps; i++){
-				src_data[chn][i] = src_buf[i];
-			}
-			src_buf += bps ;						
-		}
 
-		for(chn = 0; chn < io->channels; chn++){
-			for (i = 0; i < bps; i++){
-				*(dst_samples[chn] + i) = src_data[chn][i];
-				//fprintf(stderr,"%x ",*(dst_samples[chn] + i));
+	avail = snd_pcm_avail_update(capture->pcm);
+	if (avail < 0)
+		return avail;
+	avail /= AC108_CHANNELS / AC108_SLAVE_CHANNELS;
+	if (size > (snd_pcm_uframes_t)avail)
+		size = avail;
+
+	while (count < size) {
+		n = size - count;
+		if (n > capture->buf_frames)
+			n = capture->buf_frames;
+
+		/* no more than available, a non-blocking read returns it whole */
+		got = snd_pcm_readi(capture->pcm, capture->buf,
+							n * (AC108_CHANNELS / AC108_SLAVE_CHANNELS));
+		if (got == -EAGAIN)
+			break;
+		if (got < 0)
+			return count ? (snd_pcm_sframes_t)count : got;
+		n = got / (AC108_CHANNELS / AC108_SLAVE_CHANNELS);
+
+		src_buf = (const int32_t *)capture->buf;
+		if (dst) {
+			ac108_convert(capture, io->format, dst, src_buf, n, io->channels);
+			dst += n * io->channels * bps;
+		} else {
+			for (k = 0; k < n; k++) {
+				for (chn = 0; chn < io->channels; chn++) {
+					ac108_convert(capture, io->format, dst_samples[chn], src_buf + chn, 1, 1);
+					dst_samples[chn] += dst_steps[chn];
+				}
+				src_buf += AC108_CHANNELS;
 			}
-			//fprintf(stderr,"\n");
-			dst_samples[chn] += dst_steps[chn];	
 		}
-		count++;
+		count += n;
+		if (got % (AC108_CHANNELS / AC108_SLAVE_CHANNELS))
+			break;
 	}
 
-#endif
-
-	capture->last_size -= size;
-	
-	return size;
+	return count;
 }
 
 /*
@@ -242,6 +306,9 @@ static int ac108_close(snd_pcm_ioplug_t *io) {
 	if (capture->pcm)  
 		snd_pcm_close(capture->pcm);
 
+	free(capture->hw_params);
+	free(capture->buf);
+	free(capture);
 	return 0;
 }
 
@@ -299,12 +366,7 @@ static int setSoftwareParams(struct ac108_t *capture) {
 	if (err < 0) 
 		SNDERR("Unable to configure software parameters: %s",snd_strerror(err));
 
-
-
-	return 0;
 done:
-	snd_pcm_sw_params_free(softwareParams);
-
 	return err;
 }
 /*
@@ -318,19 +380,20 @@ static int ac108_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params) {
 	snd_pcm_uframes_t buffer_size;
 	int err;
 	if (!capture->hw_params) {
-		err = ac108_slave_hw_params_half(capture, 2*io->rate,io->format);
+		err = ac108_slave_hw_params_half(capture, 2*io->rate, SND_PCM_FORMAT_S32);
 		if (err < 0) {
 			SNDERR("ac108_slave_hw_params_half error\n");
 			return err;
 		}
 	}
-	period_size = io->period_size;
+	/* same period and buffer time as the client, twice the frames */
+	period_size = io->period_size * (AC108_CHANNELS / AC108_SLAVE_CHANNELS);
 	if ((err = snd_pcm_hw_params_set_period_size_near(capture->pcm, capture->hw_params,
 													  &period_size, NULL)) < 0) {
 		SNDERR("Cannot set pcm period size %ld", period_size);
 		return err;
 	}
-	buffer_size = io->buffer_size;
+	buffer_size = io->buffer_size * (AC108_CHANNELS / AC108_SLAVE_CHANNELS);
 	if ((err = snd_pcm_hw_params_set_buffer_size_near(capture->pcm, capture->hw_params,
 													  &buffer_size)) < 0) {
 		SNDERR("Cannot set pcm buffer size %ld", buffer_size);
@@ -340,7 +403,17 @@ static int ac108_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params) {
 		SNDERR("Cannot set pcm hw_params");
 		return err;
 	}
-	setSoftwareParams(capture);
+	if ((err = setSoftwareParams(capture)) < 0)
+		return err;
+
+	/* transfer() reads at most a period at a time */
+	free(capture->buf);
+	capture->buf_frames = io->period_size;
+	capture->buf = malloc(capture->buf_frames * AC108_CHANNELS * sizeof(int32_t));
+	if (!capture->buf) {
+		SNDERR("cannot allocate");
+		return -ENOMEM;
+	}
 	return 0;
 }
 /*
@@ -350,6 +423,9 @@ static int ac108_hw_free(snd_pcm_ioplug_t *io) {
 	struct ac108_t *capture = io->private_data;
 	free(capture->hw_params);
 	capture->hw_params = NULL;
+	free(capture->buf);
+	capture->buf = NULL;
+	capture->buf_frames = 0;
 	
 	return snd_pcm_hw_free(capture->pcm);
 
@@ -358,8 +434,7 @@ static int ac108_hw_free(snd_pcm_ioplug_t *io) {
 
 static int ac108_prepare(snd_pcm_ioplug_t *io) {
 	struct ac108_t *capture = io->private_data;
-	capture->ptr = 0;
-	capture->last_size =0;
+
 	return snd_pcm_prepare(capture->pcm);
 }
 static int ac108_drain(snd_pcm_ioplug_t *io) {
@@ -373,7 +448,12 @@ static int ac108_sw_params(snd_pcm_ioplug_t *io, snd_pcm_sw_params_t *params) {
 }
 #endif 
 static int ac108_delay(snd_pcm_ioplug_t * io, snd_pcm_sframes_t * delayp){
+	struct ac108_t *capture = io->private_data;
+	int err;
 
+	if ((err = snd_pcm_delay(capture->pcm, delayp)) < 0)
+		return err;
+	*delayp /= AC108_CHANNELS / AC108_SLAVE_CHANNELS;
 	return 0;
 }
 /*
@@ -401,8 +481,11 @@ static int ac108_set_hw_constraint(struct ac108_t  *capture) {
 	static unsigned int accesses[] = {
 		SND_PCM_ACCESS_RW_INTERLEAVED 
 	};
+	/* the slave is always S32, converted in transfer() */
 	unsigned int formats[] = { SND_PCM_FORMAT_S32,
-							   SND_PCM_FORMAT_S16 };
+							   SND_PCM_FORMAT_S16,
+							   SND_PCM_FORMAT_S24_3LE,
+							   SND_PCM_FORMAT_FLOAT };
 
 	unsigned int  rates[] = {
 		8000,
@@ -464,7 +547,8 @@ SND_PCM_PLUGIN_DEFINE_FUNC(ac108) {
 	int err;
 	const char *pcm_string = NULL;
 	struct ac108_t *capture;
-	int channels;
+	double gain_db = 0.0;
+	long channels;
 	if (stream != SND_PCM_STREAM_CAPTURE) {
 		SNDERR("a108 is only for capture");
 		return -EINVAL;
@@ -485,18 +569,29 @@ SND_PCM_PLUGIN_DEFINE_FUNC(ac108) {
 		}
 
 		if (strcmp(id, "channels") == 0) {
-			long val;
-			if (snd_config_get_integer(n, &val) < 0) {
+			if (snd_config_get_integer(n, &channels) < 0) {
 				SNDERR("Invalid type for %s", id);
 				return -EINVAL;
 			}
-			channels = val;
 			if (channels != 2 && channels != 4 && channels != 6) {
 				SNDERR("channels must be 2, 4 or 6");
 				return -EINVAL;
 			}
 			continue;
 		}
+
+		if (strcmp(id, "gain") == 0) {
+			/* dB */
+			if (snd_config_get_ireal(n, &gain_db) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (gain_db < -60.0 || gain_db > 40.0) {
+				SNDERR("gain must be -60 to 40 dB");
+				return -EINVAL;
+			}
+			continue;
+		}
 	}
 
 
@@ -505,12 +600,13 @@ SND_PCM_PLUGIN_DEFINE_FUNC(ac108) {
 		SNDERR("cannot allocate");
 		return -ENOMEM;
 	}
-	err = snd_pcm_open(&capture->pcm, pcm_string, stream, mode);
+	capture->gain_f = pow(10.0, gain_db / 20.0);
+	capture->gain = lrint(capture->gain_f * AC108_GAIN_UNITY);
+	capture->gain_f /= 2147483648.0f;
+	/* never block in transfer(), ioplug polls the slave for the client */
+	err = snd_pcm_open(&capture->pcm, pcm_string, stream, mode | SND_PCM_NONBLOCK);
 	if (err < 0) goto error;
 
-
-	
-	//SND_PCM_NONBLOCK
 	capture->io.version = SND_PCM_IOPLUG_VERSION;
 	capture->io.name = "AC108 decode Plugin";
 	capture->io.mmap_rw = 0;
@@ -521,6 +617,7 @@ SND_PCM_PLUGIN_DEFINE_FUNC(ac108) {
 	if (err < 0) goto error;
 
 	if ((err = ac108_set_hw_constraint(capture)) < 0) {
+		/* closes the slave and frees capture, by ac108_close() */
 		snd_pcm_ioplug_delete(&capture->io);
 		return err;
 	}
@@ -0,0 +1,180 @@
+/*
+ * pcm_beamform.c -- beamforming/DOA capture plugin for seeed voicecards
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Slave: the raw S32 mic channels of the card.
+ * Client channel 0: delay-and-sum beam steered to the current DOA.
+ * Client channel 1 (optional): DOA in degree, Q16, held per DOA window.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include "beamform.h"
+
+struct beamform_t {
+	snd_pcm_extplug_t ext;
+	int mics;
+	double radius;				/* meter */
+	struct bf_state bf;
+};
+
+static inline int32_t *area_addr(const snd_pcm_channel_area_t *area,
+				 snd_pcm_uframes_t offset) {
+	return (int32_t *)((char *)area->addr + area->first / 8 + offset * area->step / 8);
+}
+
+static snd_pcm_sframes_t beamform_transfer(snd_pcm_extplug_t *ext,
+					   const snd_pcm_channel_area_t *dst_areas,
+					   snd_pcm_uframes_t dst_offset,
+					   const snd_pcm_channel_area_t *src_areas,
+					   snd_pcm_uframes_t src_offset,
+					   snd_pcm_uframes_t size) {
+	struct beamform_t *bf = ext->private_data;
+	const int32_t *in[BF_MICS_MAX];
+	int32_t *out, *doa = NULL;
+	int i;
+
+	/* extplug buffers are interleaved, one step for all channels of a side */
+	for (i = 0; i < bf->mics; i++) {
+		in[i] = area_addr(&src_areas[i], src_offset);
+	}
+	out = area_addr(&dst_areas[0], dst_offset);
+	if (ext->channels > 1)
+		doa = area_addr(&dst_areas[1], dst_offset);
+
+	bf_process(&bf->bf, in, src_areas[0].step / 32,
+		   out, doa, dst_areas[0].step / 32, size);
+	return size;
+}
+
+static int beamform_init(snd_pcm_extplug_t *ext) {
+	struct beamform_t *bf = ext->private_data;
+	int err;
+
+	bf_free(&bf->bf);
+	if ((err = bf_init(&bf->bf, bf->mics, ext->rate, bf->radius)) < 0) {
+		SNDERR("beamform: cannot init %d mics, radius %g m at %u Hz",
+		       bf->mics, bf->radius, ext->rate);
+		return err;
+	}
+	return 0;
+}
+
+static int beamform_close(snd_pcm_extplug_t *ext) {
+	struct beamform_t *bf = ext->private_data;
+
+	bf_free(&bf->bf);
+	free(bf);
+	return 0;
+}
+
+static const snd_pcm_extplug_callback_t beamform_ops = {
+	.transfer = beamform_transfer,
+	.init = beamform_init,
+	.close = beamform_close,
+};
+
+/*
+ * Main entry point
+ */
+SND_PCM_PLUGIN_DEFINE_FUNC(beamform) {
+	snd_config_iterator_t i, next;
+	snd_config_t *slave = NULL;
+	struct beamform_t *bf;
+	long mics = 0, slave_channels = 0;
+	double radius = 0.0;
+	int err;
+
+	if (stream != SND_PCM_STREAM_CAPTURE) {
+		SNDERR("beamform is only for capture");
+		return -EINVAL;
+	}
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0) continue;
+		if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0 || strcmp(id, "hint") == 0) continue;
+
+		if (strcmp(id, "slave") == 0) {
+			slave = n;
+			continue;
+		}
+		if (strcmp(id, "mics") == 0) {
+			if (snd_config_get_integer(n, &mics) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "slave_channels") == 0) {
+			if (snd_config_get_integer(n, &slave_channels) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "radius") == 0) {
+			/* millimeter */
+			if (snd_config_get_ireal(n, &radius) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			radius /= 1000.0;
+			continue;
+		}
+		SNDERR("Unknown field %s", id);
+		return -EINVAL;
+	}
+
+	if (!slave) {
+		SNDERR("No slave defined for beamform");
+		return -EINVAL;
+	}
+	if (mics < 2 || mics > BF_MICS_MAX || (mics & 1)) {
+		SNDERR("mics must be 2, 4, 6 or 8");
+		return -EINVAL;
+	}
+	if (!slave_channels)
+		slave_channels = mics;
+	if (slave_channels < mics) {
+		SNDERR("slave_channels must be at least mics");
+		return -EINVAL;
+	}
+	if (radius <= 0.0) {
+		SNDERR("radius must be given in mm");
+		return -EINVAL;
+	}
+
+	bf = calloc(1, sizeof(*bf));
+	if (!bf) {
+		SNDERR("cannot allocate");
+		return -ENOMEM;
+	}
+	bf->mics = mics;
+	bf->radius = radius;
+
+	bf->ext.version = SND_PCM_EXTPLUG_VERSION;
+	bf->ext.name = "Seeed beamform Plugin";
+	bf->ext.callback = &beamform_ops;
+	bf->ext.private_data = bf;
+
+	err = snd_pcm_extplug_create(&bf->ext, name, root, slave, stream, mode);
+	if (err < 0) {
+		free(bf);
+		return err;
+	}
+
+	snd_pcm_extplug_set_param_minmax(&bf->ext, SND_PCM_EXTPLUG_HW_CHANNELS, 1, 2);
+	snd_pcm_extplug_set_param(&bf->ext, SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_S32);
+	snd_pcm_extplug_set_slave_param(&bf->ext, SND_PCM_EXTPLUG_HW_CHANNELS, slave_channels);
+	snd_pcm_extplug_set_slave_param(&bf->ext, SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_S32);
+
+	*pcmp = bf->ext.pcm;
+	return 0;
+}
+
+SND_PCM_PLUGIN_SYMBOL(beamform);
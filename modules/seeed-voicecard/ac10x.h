@@ -29,9 +29,6 @@
 /* enable headset detecting & headset button pressing */
 #define CONFIG_AC101_SWITCH_DETECT
 
-/* obsolete */
-#define CONFIG_AC10X_TRIG_LOCK	0
-
 
 #ifdef AC101_DEBG
     #define AC101_DBG(format,args...)  printk("[AC101] %s() L%d " format, __func__, __LINE__, ##args)
@@ -64,6 +61,17 @@ struct ac10x_priv {
 	struct delayed_work dlywork;
 	int tdm_chips_cnt;
 	int sysclk_en;
+	unsigned lrck_rate;	/* sample rate of last hw_params() */
+
+	/* clock tree applied by the last hw_params(), reused while unchanged */
+	unsigned clk_rate, clk_channels, clk_samp_res;
+	int clk_cached;
+	/* PLL and module clocks stay on until this runs, pll_idle_ms after STOP */
+	struct delayed_work pll_idle;
+
+	/* trigger alignment, measured by the last clock start */
+	s64 trig_skew_ns;
+	unsigned trig_skew_frames;
 
 	/* member for ac101 .begin */
 	struct snd_soc_codec *codec;
@@ -81,13 +89,11 @@ struct ac10x_priv {
 	#ifdef CONFIG_AC101_SWITCH_DETECT
 	struct gpio_desc* gpiod_irq;
 	long irq;
-	volatile int irq_cntr;
-	volatile int pullout_cntr;
+	/* jack engine state, owned by the threaded irq */
 	volatile int state;
-
 	enum headphone_mode_u mode;
-	struct work_struct work_switch;
-	struct work_struct work_clear_irq;
+	int jack_key;		/* button held down, 0 if none */
+	atomic_t jack_resync;	/* sense and report the jack on the next pass */
 
 	struct input_dev* inpdev;
 	#endif
@@ -119,8 +125,43 @@ void ac101_shutdown(struct i2c_client *i2c);
 int ac101_remove(struct i2c_client *i2c);
 
 /* seeed voice card export */
-int seeed_voice_card_register_set_clock(int stream, int (*set_clock)(int));
+/*
+ * set_clock() commands, issued by the machine driver:
+ *   PREPARE from prepare(), process context, stream not running yet.
+ *   START/STOP from the trigger kthread, never from atomic context.
+ */
+#define SEEED_CLOCK_STOP	0
+#define SEEED_CLOCK_START	1
+#define SEEED_CLOCK_PREPARE	2
+/* per card: a card calls the ones registered on its own codec DAIs' device */
+int seeed_voice_card_register_set_clock(struct device *dev, int stream, int (*set_clock)(int));
+void seeed_voice_card_unregister_set_clock(struct device *dev);
 
 int ac10x_fill_regcache(struct device* dev, struct regmap* map);
 
+/* register access profiler, ac10x_prof.c */
+enum ac10x_prof_path {
+	AC10X_PATH_OTHER,
+	AC10X_PATH_HW_PARAMS,
+	AC10X_PATH_TRIGGER,
+	AC10X_PATH_SET_CLOCK,
+	AC10X_PATH_BIAS,
+	AC10X_PATH_CNT,
+};
+#define AC10X_PROF_CHIPS	(AC101_I2C_ID + 1)	/* ac108_0..3, ac101 */
+
+#define AC10X_PROF_READ		0x1
+#define AC10X_PROF_BUS_READ	0x2	/* not served by the register cache */
+#define AC10X_PROF_WRITE	0x4
+#define AC10X_PROF_BUS_WRITE	0x8	/* value changed, or a plain write */
+
+/* charge the accesses of this task to path until ac10x_prof_leave(returned) */
+int ac10x_prof_enter(int path);
+void ac10x_prof_leave(int saved);
+/* 0 when profiling is off, then ac10x_prof_account() does nothing */
+u64 ac10x_prof_start(void);
+void ac10x_prof_account(u64 t0, int chip, unsigned reg, unsigned flags);
+void ac10x_prof_init(void);
+void ac10x_prof_release(void);
+
 #endif//__AC10X_H__
@@ -0,0 +1,270 @@
+/*
+ * ac10x_prof.c  --  AC108/AC101 register access profiler
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Counts every register access made through the ac10x/ac101 helpers, per
+ * chip, per register and per code path (hw_params, trigger, set_clock,
+ * bias, anything else), and tells the cache hits from the I2C transfers.
+ *
+ * debugfs seeed-ac10x/enable: 1 starts counting, 0 stops, off at load
+ * debugfs seeed-ac10x/stats:
+ *   read : per path totals, then one line per path/chip/register touched
+ *   write: anything, clears the counters
+ *
+ * A path is charged to the task which entered it only; accesses from
+ * other tasks meanwhile, pll_idle or the jack engine, count as "other".
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <sound/soc.h>
+#include "ac10x.h"
+
+#define PROF_REGS		256
+
+static const char *const prof_path_name[AC10X_PATH_CNT] = {
+	[AC10X_PATH_OTHER]	= "other",
+	[AC10X_PATH_HW_PARAMS]	= "hw_params",
+	[AC10X_PATH_TRIGGER]	= "trigger",
+	[AC10X_PATH_SET_CLOCK]	= "set_clock",
+	[AC10X_PATH_BIAS]	= "bias",
+};
+
+static const char *const prof_chip_name[AC10X_PROF_CHIPS] = {
+	"ac108_0", "ac108_1", "ac108_2", "ac108_3", "ac101",
+};
+
+struct prof_reg {
+	atomic_t reads, writes;		/* helper calls */
+	atomic_t bus_reads, bus_writes;	/* of them, reaching the I2C bus */
+	atomic64_t ns;			/* spent in the calls */
+};
+
+struct prof_chip {
+	struct prof_reg reg[AC10X_PATH_CNT][PROF_REGS];
+};
+
+static struct prof_chip *prof;		/* AC10X_PROF_CHIPS, allocated on first enable */
+static bool prof_on;
+static DEFINE_MUTEX(prof_lock);
+static struct dentry *prof_debugfs;
+
+/* the path being run, and by whom */
+static struct task_struct *prof_task;
+static int prof_path;
+
+int ac10x_prof_enter(int path) {
+	int saved;
+
+	if (!READ_ONCE(prof_on)) {
+		return AC10X_PATH_OTHER;
+	}
+	saved = (READ_ONCE(prof_task) == current)? READ_ONCE(prof_path): AC10X_PATH_OTHER;
+	WRITE_ONCE(prof_path, path);
+	WRITE_ONCE(prof_task, current);
+	return saved;
+}
+
+void ac10x_prof_leave(int saved) {
+	if (READ_ONCE(prof_task) != current) {
+		return;
+	}
+	if (saved == AC10X_PATH_OTHER) {
+		WRITE_ONCE(prof_task, NULL);
+	} else {
+		WRITE_ONCE(prof_path, saved);
+	}
+}
+
+u64 ac10x_prof_start(void) {
+	return READ_ONCE(prof_on)? ktime_get_ns(): 0;
+}
+
+void ac10x_prof_account(u64 t0, int chip, unsigned reg, unsigned flags) {
+	struct prof_chip *pc = READ_ONCE(prof);
+	struct prof_reg *p;
+	int path;
+
+	if (!t0 || !pc || chip < 0 || chip >= AC10X_PROF_CHIPS || reg >= PROF_REGS) {
+		return;
+	}
+	path = (READ_ONCE(prof_task) == current)? READ_ONCE(prof_path): AC10X_PATH_OTHER;
+	p = &pc[chip].reg[path][reg];
+
+	if (flags & AC10X_PROF_READ) {
+		atomic_inc(&p->reads);
+	}
+	if (flags & AC10X_PROF_BUS_READ) {
+		atomic_inc(&p->bus_reads);
+	}
+	if (flags & AC10X_PROF_WRITE) {
+		atomic_inc(&p->writes);
+	}
+	if (flags & AC10X_PROF_BUS_WRITE) {
+		atomic_inc(&p->bus_writes);
+	}
+	atomic64_add(ktime_get_ns() - t0, &p->ns);
+}
+
+static int prof_stats_show(struct seq_file *s, void *unused) {
+	unsigned reads, writes, bus_reads, bus_writes;
+	struct prof_reg *p;
+	int c, path, r;
+	u64 ns;
+
+	mutex_lock(&prof_lock);
+	if (!prof) {
+		seq_puts(s, "off, echo 1 > enable\n");
+		goto __ret;
+	}
+
+	seq_printf(s, "%-10s %8s %8s %8s %8s %10s\n",
+		   "path", "reads", "hits", "writes", "skipped", "us");
+	for (path = 0; path < AC10X_PATH_CNT; path++) {
+		reads = writes = bus_reads = bus_writes = 0;
+		ns = 0;
+		for (c = 0; c < AC10X_PROF_CHIPS; c++) {
+			for (r = 0; r < PROF_REGS; r++) {
+				p = &prof[c].reg[path][r];
+				reads      += atomic_read(&p->reads);
+				bus_reads  += atomic_read(&p->bus_reads);
+				writes     += atomic_read(&p->writes);
+				bus_writes += atomic_read(&p->bus_writes);
+				ns         += atomic64_read(&p->ns);
+			}
+		}
+		seq_printf(s, "%-10s %8u %8u %8u %8u %10llu\n", prof_path_name[path],
+			   reads, reads - bus_reads, writes, writes - bus_writes,
+			   div_u64(ns, NSEC_PER_USEC));
+	}
+
+	seq_printf(s, "\n%-10s %-8s %4s %8s %8s %8s %8s %10s\n",
+		   "path", "chip", "reg", "reads", "hits", "writes", "skipped", "us");
+	for (path = 0; path < AC10X_PATH_CNT; path++) {
+		for (c = 0; c < AC10X_PROF_CHIPS; c++) {
+			for (r = 0; r < PROF_REGS; r++) {
+				p = &prof[c].reg[path][r];
+				reads  = atomic_read(&p->reads);
+				writes = atomic_read(&p->writes);
+				if (!reads && !writes) {
+					continue;
+				}
+				seq_printf(s, "%-10s %-8s 0x%02x %8u %8u %8u %8u %10llu\n",
+					   prof_path_name[path], prof_chip_name[c], r,
+					   reads, reads - atomic_read(&p->bus_reads),
+					   writes, writes - atomic_read(&p->bus_writes),
+					   div_u64(atomic64_read(&p->ns), NSEC_PER_USEC));
+			}
+		}
+	}
+__ret:
+	mutex_unlock(&prof_lock);
+	return 0;
+}
+
+static int prof_stats_open(struct inode *inode, struct file *file) {
+	return single_open(file, prof_stats_show, inode->i_private);
+}
+
+static ssize_t prof_stats_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos) {
+	struct prof_reg *p;
+	int c, path, r;
+
+	mutex_lock(&prof_lock);
+	for (c = 0; prof && c < AC10X_PROF_CHIPS; c++) {
+		for (path = 0; path < AC10X_PATH_CNT; path++) {
+			for (r = 0; r < PROF_REGS; r++) {
+				p = &prof[c].reg[path][r];
+				atomic_set(&p->reads, 0);
+				atomic_set(&p->writes, 0);
+				atomic_set(&p->bus_reads, 0);
+				atomic_set(&p->bus_writes, 0);
+				atomic64_set(&p->ns, 0);
+			}
+		}
+	}
+	mutex_unlock(&prof_lock);
+	return count;
+}
+
+static const struct file_operations prof_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= prof_stats_open,
+	.read		= seq_read,
+	.write		= prof_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static ssize_t prof_enable_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos) {
+	char s[2] = { READ_ONCE(prof_on)? '1': '0', '\n' };
+
+	return simple_read_from_buffer(buf, count, ppos, s, sizeof s);
+}
+
+static ssize_t prof_enable_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos) {
+	bool on;
+	int r;
+
+	if ((r = kstrtobool_from_user(buf, count, &on)) < 0) {
+		return r;
+	}
+
+	mutex_lock(&prof_lock);
+	if (on && !prof) {
+		/* kept until unload, an access may be in flight when switched off */
+		WRITE_ONCE(prof, vzalloc(AC10X_PROF_CHIPS * sizeof *prof));
+	}
+	if (on && !prof) {
+		r = -ENOMEM;
+	} else {
+		WRITE_ONCE(prof_on, on);
+		r = count;
+	}
+	mutex_unlock(&prof_lock);
+	return r;
+}
+
+static const struct file_operations prof_enable_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= prof_enable_read,
+	.write		= prof_enable_write,
+	.llseek		= default_llseek,
+};
+
+void ac10x_prof_init(void) {
+	prof_debugfs = debugfs_create_dir("seeed-ac10x", NULL);
+	if (IS_ERR_OR_NULL(prof_debugfs)) {
+		prof_debugfs = NULL;
+		return;
+	}
+	debugfs_create_file("enable", S_IRUGO | S_IWUSR, prof_debugfs, NULL, &prof_enable_fops);
+	debugfs_create_file("stats", S_IRUGO | S_IWUSR, prof_debugfs, NULL, &prof_stats_fops);
+}
+
+/* no register access may be left */
+void ac10x_prof_release(void) {
+	debugfs_remove_recursive(prof_debugfs);
+	prof_debugfs = NULL;
+
+	WRITE_ONCE(prof_on, false);
+	vfree(prof);
+	prof = NULL;
+	prof_task = NULL;
+}
@@ -0,0 +1,311 @@
+/*
+ * capture_ring.h -- shared-memory ring of one capture stream, many readers
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * One writer (seeed-captured) publishes whole periods of interleaved S32_LE
+ * frames. Any number of readers map the ring read-only, each with its own
+ * cursor, and work on the frames in place. Nothing is locked: the write
+ * position is the only shared state and the writer never waits for a
+ * reader. A reader falling more than the ring behind loses frames and is
+ * told so.
+ *
+ * Reader:
+ *	struct cr_reader r;
+ *	const int32_t *f;
+ *	long n;
+ *
+ *	cr_reader_open(&r, CR_NAME_DEFAULT);
+ *	for (;;) {
+ *		cr_reader_wait(&r, 1000);
+ *		while ((n = cr_reader_peek(&r, &f)) != 0) {
+ *			if (n < 0)		// -EPIPE, frames lost, cursor moved on
+ *				continue;
+ *			use(f, n);		// n frames of r.h->channels samples
+ *			cr_reader_done(&r, n);	// -EPIPE: overwritten while in use
+ *		}
+ *	}
+ */
+#ifndef __CAPTURE_RING_H__
+#define __CAPTURE_RING_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define CR_MAGIC		0x53524e47	/* "GNRS" */
+#define CR_VERSION		1
+#define CR_NAME_DEFAULT		"/seeed-capture"
+#define CR_DATA_OFFSET		4096		/* frames start on their own page */
+#define CR_STAMPS		64		/* capture time of the last periods */
+
+struct cr_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rate;
+	uint32_t channels;			/* interleaved S32_LE */
+	uint32_t capacity;			/* frames, power of two */
+	uint32_t period;			/* frames per publish, power of two */
+	uint32_t data_offset;			/* bytes, from the header */
+	uint32_t writer_pid;
+
+	/* written by the writer only, apart from the read-mostly part above */
+	_Atomic uint64_t write_pos __attribute__((aligned(64)));	/* frames ever published */
+	_Atomic uint64_t xruns;
+	_Atomic uint32_t seq;			/* futex word, bumped per publish */
+	_Atomic uint32_t closed;
+	/* CLOCK_MONOTONIC ns the last frame of period p was captured, p % CR_STAMPS */
+	_Atomic uint64_t stamp_ns[CR_STAMPS];
+};
+
+static inline uint64_t cr_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int cr_is_pow2(uint32_t v) {
+	return v && !(v & (v - 1));
+}
+
+static inline size_t cr_size(uint32_t channels, uint32_t capacity) {
+	return CR_DATA_OFFSET + (size_t)capacity * channels * sizeof(int32_t);
+}
+
+static inline int32_t *cr_frames(const struct cr_header *h, uint64_t pos) {
+	return (int32_t *)((char *)h + h->data_offset) +
+	       (size_t)(pos & (h->capacity - 1)) * h->channels;
+}
+
+static inline long cr_futex(_Atomic uint32_t *addr, int op, uint32_t val,
+			    const struct timespec *ts) {
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+/*
+ * Writer
+ */
+struct cr_writer {
+	struct cr_header *h;
+	size_t size;
+	char name[NAME_MAX];
+};
+
+/* return 0 or -errno */
+static inline int cr_writer_create(struct cr_writer *w, const char *name,
+				   uint32_t rate, uint32_t channels,
+				   uint32_t capacity, uint32_t period) {
+	struct cr_header *h;
+	int fd, err;
+
+	if (!rate || !channels || !cr_is_pow2(capacity) || !cr_is_pow2(period) ||
+	    capacity < 4 * period)
+		return -EINVAL;
+
+	memset(w, 0, sizeof *w);
+	snprintf(w->name, sizeof w->name, "%s", name);
+	w->size = cr_size(channels, capacity);
+
+	/* a stale ring of a dead writer is replaced, readers keep the old one */
+	shm_unlink(w->name);
+	fd = shm_open(w->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, w->size) < 0) {
+		err = -errno;
+		goto __unlink;
+	}
+	h = mmap(NULL, w->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		err = -errno;
+		goto __unlink;
+	}
+	close(fd);
+
+	h->rate = rate;
+	h->channels = channels;
+	h->capacity = capacity;
+	h->period = period;
+	h->data_offset = CR_DATA_OFFSET;
+	h->writer_pid = getpid();
+	h->version = CR_VERSION;
+	/* readers check the magic last */
+	atomic_thread_fence(memory_order_release);
+	h->magic = CR_MAGIC;
+
+	w->h = h;
+	return 0;
+
+__unlink:
+	close(fd);
+	shm_unlink(w->name);
+	return err;
+}
+
+/* where the next period goes, readers don't see it before publish */
+static inline int32_t *cr_writer_next(struct cr_writer *w) {
+	return cr_frames(w->h, atomic_load_explicit(&w->h->write_pos, memory_order_relaxed));
+}
+
+static inline void cr_writer_publish(struct cr_writer *w, uint64_t stamp_ns) {
+	struct cr_header *h = w->h;
+	uint64_t pos = atomic_load_explicit(&h->write_pos, memory_order_relaxed);
+
+	atomic_store_explicit(&h->stamp_ns[(pos / h->period) % CR_STAMPS], stamp_ns,
+			      memory_order_relaxed);
+	atomic_store_explicit(&h->write_pos, pos + h->period, memory_order_release);
+	atomic_fetch_add_explicit(&h->seq, 1, memory_order_release);
+	cr_futex(&h->seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static inline void cr_writer_close(struct cr_writer *w) {
+	if (!w->h)
+		return;
+	atomic_store(&w->h->closed, 1);
+	atomic_fetch_add(&w->h->seq, 1);
+	cr_futex(&w->h->seq, FUTEX_WAKE, INT_MAX, NULL);
+	munmap(w->h, w->size);
+	shm_unlink(w->name);
+	w->h = NULL;
+}
+
+/*
+ * Reader
+ */
+struct cr_reader {
+	const struct cr_header *h;
+	size_t size;
+	uint64_t pos;				/* next frame to read */
+	uint64_t lost;				/* frames skipped, overrun */
+};
+
+/* start at the live position; return 0 or -errno */
+static inline int cr_reader_open(struct cr_reader *r, const char *name) {
+	struct cr_header *h;
+	struct stat st;
+	int fd, err = 0;
+
+	memset(r, 0, sizeof *r);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		goto __close;
+	}
+	if ((size_t)st.st_size < CR_DATA_OFFSET) {
+		err = -EAGAIN;
+		goto __close;
+	}
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		err = -errno;
+		goto __close;
+	}
+	if (h->magic != CR_MAGIC || h->version != CR_VERSION ||
+	    (size_t)st.st_size < cr_size(h->channels, h->capacity)) {
+		/* header not written yet, or from another version */
+		err = h->magic != CR_MAGIC ? -EAGAIN : -EPROTO;
+		munmap(h, st.st_size);
+		goto __close;
+	}
+	atomic_thread_fence(memory_order_acquire);
+
+	r->h = h;
+	r->size = st.st_size;
+	r->pos = atomic_load_explicit(&h->write_pos, memory_order_acquire);
+__close:
+	close(fd);
+	return err;
+}
+
+static inline void cr_reader_close(struct cr_reader *r) {
+	if (r->h)
+		munmap((void *)r->h, r->size);
+	r->h = NULL;
+}
+
+/* the writer fills [write_pos, write_pos + period) before publishing it */
+static inline int cr_reader_lapped(const struct cr_reader *r, uint64_t wpos) {
+	return wpos + r->h->period - r->pos > r->h->capacity;
+}
+
+/*
+ * Contiguous frames ready at *frames, 0 if none.
+ * -EPIPE if the writer overran the cursor: it moves to half a ring behind
+ * the writer, r->lost counts what was skipped.
+ */
+static inline long cr_reader_peek(struct cr_reader *r, const int32_t **frames) {
+	const struct cr_header *h = r->h;
+	uint64_t wpos = atomic_load_explicit(&h->write_pos, memory_order_acquire);
+	uint64_t avail, n;
+
+	if (cr_reader_lapped(r, wpos)) {
+		n = wpos - h->capacity / 2;
+		r->lost += n - r->pos;
+		r->pos = n;
+		return -EPIPE;
+	}
+
+	avail = wpos - r->pos;
+	n = h->capacity - (r->pos & (h->capacity - 1));
+	if (n > avail)
+		n = avail;
+	*frames = cr_frames(h, r->pos);
+	return n;
+}
+
+/* 0, or -EPIPE if the frames given by peek were overwritten meanwhile */
+static inline int cr_reader_done(struct cr_reader *r, uint64_t frames) {
+	uint64_t wpos;
+
+	atomic_thread_fence(memory_order_acquire);
+	wpos = atomic_load_explicit(&r->h->write_pos, memory_order_relaxed);
+	if (cr_reader_lapped(r, wpos)) {
+		r->pos += frames;
+		return -EPIPE;
+	}
+	r->pos += frames;
+	return 0;
+}
+
+/* capture time of the last frame published up to pos, 0 if too old */
+static inline uint64_t cr_reader_stamp(const struct cr_reader *r, uint64_t pos) {
+	const struct cr_header *h = r->h;
+	uint64_t wpos = atomic_load_explicit(&h->write_pos, memory_order_acquire);
+
+	if (!pos || wpos - pos >= (uint64_t)h->period * (CR_STAMPS - 1))
+		return 0;
+	return atomic_load_explicit(&h->stamp_ns[((pos - 1) / h->period) % CR_STAMPS],
+				    memory_order_relaxed);
+}
+
+/* sleep until frames are published; 0, -ETIMEDOUT, -EINTR or -ENODEV (writer gone) */
+static inline int cr_reader_wait(struct cr_reader *r, int timeout_ms) {
+	struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+	_Atomic uint32_t *seq = (_Atomic uint32_t *)&r->h->seq;
+	uint32_t s = atomic_load_explicit(seq, memory_order_acquire);
+
+	if (atomic_load_explicit(&r->h->write_pos, memory_order_acquire) != r->pos)
+		return 0;
+	if (atomic_load(&r->h->closed))
+		return -ENODEV;
+	if (cr_futex(seq, FUTEX_WAIT, s, timeout_ms < 0 ? NULL : &ts) < 0 &&
+	    errno != EAGAIN)
+		return -errno;
+	return 0;
+}
+
+#endif//__CAPTURE_RING_H__
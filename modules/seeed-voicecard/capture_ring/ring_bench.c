@@ -0,0 +1,249 @@
+/*
+ * ring_bench.c -- capture_ring throughput and latency, per reader
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Attaches -t readers to a running seeed-captured ring for -d seconds.
+ * Each reader touches every sample in place and reports frames/s, frames
+ * lost to overruns and the latency from capture (the period stamp) to the
+ * reader seeing the period.
+ *
+ * -S runs its own writer instead, no card needed: full speed for ring
+ * throughput, or paced at -r for latency. Its frames carry their position,
+ * readers verify them and count torn ones.
+ *
+ * Usage: ring_bench [-s shm name] [-t readers] [-d seconds] [-w work us]
+ *                   [-S [-r rate] [-c channels] [-p period] [-n ring frames]]
+ * -r 0 with -S: writer at full speed. Exit 1 on torn frames or reader errors.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture_ring.h"
+
+#define LAT_BUCKETS		100000		/* 1 us each, last one is the overflow */
+#define READERS_MAX		32
+
+struct reader {
+	pthread_t tid;
+	int id;
+	uint64_t frames, lost, torn, lapped, lat_cnt;
+	uint64_t lat_sum, lat_max;
+	uint32_t *lat_hist;
+	unsigned channels;
+	int64_t sum;				/* keeps the sample loop alive */
+	int err;
+};
+
+static const char *shm_name = CR_NAME_DEFAULT;
+static unsigned duration = 10, work_us;
+static int synthetic;
+static volatile int stop;
+
+static void *writer_fn(void *arg) {
+	struct cr_writer *w = arg;
+	struct cr_header *h = w->h;
+	struct timespec next;
+	uint64_t pos = 0, step;
+	int32_t *f;
+	unsigned k;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	step = h->rate ? (uint64_t)h->period * 1000000000ULL / h->rate : 0;
+	while (!stop) {
+		f = cr_writer_next(w);
+		/* sample 0 of a frame: its position, the rest left as is */
+		for (k = 0; k < h->period; k++) {
+			f[(size_t)k * h->channels] = (int32_t)(pos + k);
+		}
+		pos += h->period;
+		cr_writer_publish(w, cr_now_ns());
+
+		if (step) {
+			next.tv_nsec += step;
+			while (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+	return NULL;
+}
+
+static void busy_wait_us(unsigned us) {
+	uint64_t end = cr_now_ns() + us * 1000ULL;
+
+	while (cr_now_ns() < end);
+}
+
+static void *reader_fn(void *arg) {
+	struct reader *rd = arg;
+	struct cr_reader r;
+	const int32_t *f;
+	uint64_t stamp, lat, k, n;
+	long got;
+	int err;
+
+	if ((err = cr_reader_open(&r, shm_name)) < 0) {
+		rd->err = err;
+		return NULL;
+	}
+	rd->channels = r.h->channels;
+
+	while (!stop) {
+		err = cr_reader_wait(&r, 100);
+		if (err == -ENODEV)
+			break;
+		while (!stop && (got = cr_reader_peek(&r, &f)) != 0) {
+			if (got < 0) {
+				rd->lapped++;
+				continue;
+			}
+			n = got;
+
+			stamp = cr_reader_stamp(&r, r.pos + n);
+			if (stamp) {
+				lat = (cr_now_ns() - stamp) / 1000;
+				rd->lat_sum += lat;
+				rd->lat_cnt++;
+				if (lat > rd->lat_max)
+					rd->lat_max = lat;
+				rd->lat_hist[lat < LAT_BUCKETS ? lat : LAT_BUCKETS - 1]++;
+			}
+
+			for (k = 0; k < n * r.h->channels; k++) {
+				rd->sum += f[k];
+			}
+			if (synthetic) {
+				for (k = 0; k < n; k++) {
+					if (f[k * r.h->channels] != (int32_t)(r.pos + k))
+						break;
+				}
+			}
+			if (work_us)
+				busy_wait_us(work_us);
+
+			/* a mismatch only counts if the writer did not lap us meanwhile */
+			if (cr_reader_done(&r, n) < 0)
+				rd->lapped++;
+			else if (synthetic && k < n)
+				rd->torn++;
+			rd->frames += n;
+		}
+	}
+	rd->lost = r.lost;
+	cr_reader_close(&r);
+	return NULL;
+}
+
+static uint64_t percentile(const uint32_t *hist, uint64_t cnt, double p) {
+	uint64_t acc = 0, want = cnt * p;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		acc += hist[i];
+		if (acc > want)
+			return i;
+	}
+	return LAT_BUCKETS - 1;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned rate = 16000, channels = 4, period = 256, capacity = 32768;
+	struct reader rd[READERS_MAX];
+	struct cr_writer w = { 0 };
+	pthread_t writer;
+	char name[64];
+	int readers = 1, i, opt, err, fail = 0;
+	uint64_t t0, t1;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "s:t:d:w:Sr:c:p:n:")) != -1) {
+		switch (opt) {
+		case 's': shm_name = optarg; break;
+		case 't': readers = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		case 'w': work_us = atoi(optarg); break;
+		case 'S': synthetic = 1; break;
+		case 'r': rate = atoi(optarg); break;
+		case 'c': channels = atoi(optarg); break;
+		case 'p': period = atoi(optarg); break;
+		case 'n': capacity = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-s shm name] [-t readers] [-d seconds] [-w work us]"
+				" [-S [-r rate] [-c channels] [-p period] [-n ring frames]]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (readers < 1 || readers > READERS_MAX) {
+		fprintf(stderr, "1 to %d readers\n", READERS_MAX);
+		return 2;
+	}
+
+	if (synthetic) {
+		snprintf(name, sizeof name, "/seeed-capture-bench-%d", (int)getpid());
+		shm_name = name;
+		/* rate 0: unpaced, the header still needs one */
+		if ((err = cr_writer_create(&w, shm_name, rate ? rate : 1, channels,
+					    capacity, period)) < 0) {
+			fprintf(stderr, "ring: %s\n", strerror(-err));
+			return 2;
+		}
+		if (!rate)
+			w.h->rate = 0;
+	}
+
+	memset(rd, 0, sizeof rd);
+	for (i = 0; i < readers; i++) {
+		rd[i].id = i;
+		rd[i].lat_hist = calloc(LAT_BUCKETS, sizeof(uint32_t));
+		if (!rd[i].lat_hist) {
+			fprintf(stderr, "cannot allocate\n");
+			return 2;
+		}
+		pthread_create(&rd[i].tid, NULL, reader_fn, &rd[i]);
+	}
+	/* readers start at the live position, let them attach first */
+	usleep(100000);
+	if (synthetic)
+		pthread_create(&writer, NULL, writer_fn, &w);
+
+	t0 = cr_now_ns();
+	sleep(duration);
+	stop = 1;
+	t1 = cr_now_ns();
+	secs = (t1 - t0) / 1e9;
+
+	if (synthetic) {
+		pthread_join(writer, NULL);
+		cr_writer_close(&w);
+	}
+
+	printf("%-6s %12s %10s %10s %8s %8s %10s %10s %10s %10s\n", "reader", "frames/s", "MB/s",
+	       "lost", "lapped", "torn", "avg us", "p50 us", "p99 us", "max us");
+	for (i = 0; i < readers; i++) {
+		struct reader *p = &rd[i];
+
+		pthread_join(p->tid, NULL);
+		if (p->err) {
+			fprintf(stderr, "reader %d: %s\n", i, strerror(-p->err));
+			fail = 1;
+			continue;
+		}
+		printf("%-6d %12.0f %10.1f %10llu %8llu %8llu %10.1f %10llu %10llu %10llu\n", i,
+		       p->frames / secs, p->frames * p->channels * 4.0 / secs / 1e6,
+		       (unsigned long long)p->lost, (unsigned long long)p->lapped,
+		       (unsigned long long)p->torn,
+		       p->lat_cnt ? (double)p->lat_sum / p->lat_cnt : 0.0,
+		       (unsigned long long)percentile(p->lat_hist, p->lat_cnt, 0.50),
+		       (unsigned long long)percentile(p->lat_hist, p->lat_cnt, 0.99),
+		       (unsigned long long)p->lat_max);
+		if (p->torn)
+			fail = 1;
+		free(p->lat_hist);
+	}
+	return fail;
+}
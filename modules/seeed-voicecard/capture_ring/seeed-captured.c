@@ -0,0 +1,139 @@
+/*
+ * seeed-captured.c -- open a seeed voicecard once, share it through capture_ring
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Reads whole periods of S32_LE frames straight into the shared ring, the
+ * only copy made; readers work on the ring in place, see capture_ring.h.
+ * Each period is stamped with the time its last frame was captured, from
+ * snd_pcm_delay(), so readers can tell their latency.
+ *
+ * Usage: seeed-captured [-D hw:seeed4micvoicec] [-r rate] [-c channels]
+ *                       [-p period] [-n ring frames] [-s shm name] [-P prio]
+ */
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+#include "capture_ring.h"
+
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig) {
+	quit = 1;
+}
+
+static int set_hw_params(snd_pcm_t *pcm, unsigned *rate, unsigned channels,
+			 snd_pcm_uframes_t period) {
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_uframes_t buffer = period * 4;
+	int err;
+
+	snd_pcm_hw_params_alloca(&hw);
+	if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0 ||
+	    (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S32_LE)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels(pcm, hw, channels)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate_near(pcm, hw, rate, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer)) < 0)
+		return err;
+	return snd_pcm_hw_params(pcm, hw);
+}
+
+int main(int argc, char *argv[]) {
+	const char *device = "hw:seeed4micvoicec";
+	const char *shm_name = CR_NAME_DEFAULT;
+	unsigned rate = 16000, channels = 4, period = 256, capacity = 32768;
+	struct sched_param sp = { 0 };
+	struct sigaction sa;
+	struct cr_writer w;
+	snd_pcm_sframes_t n, delay;
+	snd_pcm_t *pcm;
+	uint64_t now, stamp;
+	int32_t *buf;
+	unsigned left;
+	int opt, err, ret = 1;
+
+	while ((opt = getopt(argc, argv, "D:r:c:p:n:s:P:")) != -1) {
+		switch (opt) {
+		case 'D': device = optarg; break;
+		case 'r': rate = atoi(optarg); break;
+		case 'c': channels = atoi(optarg); break;
+		case 'p': period = atoi(optarg); break;
+		case 'n': capacity = atoi(optarg); break;
+		case 's': shm_name = optarg; break;
+		case 'P': sp.sched_priority = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-D pcm] [-r rate] [-c channels] [-p period]"
+				" [-n ring frames] [-s shm name] [-P prio]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (!cr_is_pow2(period) || !cr_is_pow2(capacity) || capacity < 4 * period) {
+		fprintf(stderr, "period and ring frames must be powers of two, ring at least 4 periods\n");
+		return 2;
+	}
+
+	if ((err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+		fprintf(stderr, "open %s: %s\n", device, snd_strerror(err));
+		return 1;
+	}
+	if ((err = set_hw_params(pcm, &rate, channels, period)) < 0) {
+		fprintf(stderr, "hw_params %s: %s\n", device, snd_strerror(err));
+		goto __pcm;
+	}
+	if ((err = cr_writer_create(&w, shm_name, rate, channels, capacity, period)) < 0) {
+		fprintf(stderr, "ring %s: %s\n", shm_name, strerror(-err));
+		goto __pcm;
+	}
+
+	if (sp.sched_priority && sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+		perror("SCHED_FIFO");
+
+	/* no SA_RESTART, a blocked readi returns on the signal */
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	fprintf(stderr, "%s: %u Hz, %u ch, period %u, ring %u frames at %s\n",
+		device, rate, channels, period, capacity, shm_name);
+
+	while (!quit) {
+		buf = cr_writer_next(&w);
+		for (left = period; left && !quit; ) {
+			n = snd_pcm_readi(pcm, buf + (size_t)(period - left) * channels, left);
+			if (n >= 0) {
+				left -= n;
+				continue;
+			}
+			if (n == -EINTR)
+				continue;
+			if (n == -EPIPE || n == -ESTRPIPE)
+				atomic_fetch_add(&w.h->xruns, 1);
+			if ((err = snd_pcm_recover(pcm, n, 1)) < 0) {
+				fprintf(stderr, "read: %s\n", snd_strerror(err));
+				goto __ring;
+			}
+		}
+		if (left)
+			break;
+
+		now = cr_now_ns();
+		stamp = now;
+		if (snd_pcm_delay(pcm, &delay) == 0 && delay > 0)
+			stamp -= (uint64_t)delay * 1000000000ULL / rate;
+		cr_writer_publish(&w, stamp);
+	}
+	ret = 0;
+
+__ring:
+	cr_writer_close(&w);
+__pcm:
+	snd_pcm_close(pcm);
+	return ret;
+}
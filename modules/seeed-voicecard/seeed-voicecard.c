@@ -18,10 +18,14 @@
 #include <linux/clk.h>
 #include <linux/device.h>
 #include <linux/gpio.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_gpio.h>
 #include <linux/platform_device.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/srcu.h>
 #include <linux/string.h>
 #include <sound/soc.h>
 #include <sound/soc-dai.h>
@@ -48,12 +52,14 @@ struct seeed_card_data {
 	unsigned channels_capture_default;
 	unsigned channels_capture_override;
 	struct snd_soc_dai_link *dai_link;
-	#if CONFIG_AC10X_TRIG_LOCK
-	spinlock_t lock;
-	#endif
-	struct work_struct work_codec_clk;
+	struct mutex clk_lock;
+	struct kthread_worker *trig_worker;
+	struct kthread_work trig_work;
+	int trig_cmd;
 	#define TRY_STOP_MAX	3
-	int try_stop;
+	struct seeed_clock_set __rcu *clk_set;
+	unsigned int clk_gen;
+	struct list_head clk_node;
 };
 
 struct seeed_card_info {
@@ -156,36 +162,204 @@ err:
 	return ret;
 }
 
+/*
+ * Codec clock controls.
+ *
+ * Codecs register set_clock() against the device their DAIs live on.
+ * Each card binds the ones behind its own codec DAIs at prepare() and
+ * calls them under SRCU, so two cards on a host neither pick up each
+ * other's callbacks nor serialize their trigger paths on a shared lock.
+ * seeed_clock_mutex only orders the rare writers.
+ */
 #define _SET_CLOCK_CNT		2
-static int (* _set_clock[_SET_CLOCK_CNT])(int y_start_n_stop);
 
-int seeed_voice_card_register_set_clock(int stream, int (*set_clock)(int)) {
-	if (! _set_clock[stream]) {
-		_set_clock[stream] = set_clock;
+struct seeed_clock_provider {
+	struct list_head list;
+	struct device *dev;
+	int stream;
+	int (*set_clock)(int cmd);
+};
+
+struct seeed_clock_set {
+	struct device *dev[_SET_CLOCK_CNT];
+	int (*set_clock[_SET_CLOCK_CNT])(int cmd);
+};
+
+static LIST_HEAD(seeed_clock_providers);
+static LIST_HEAD(seeed_clock_cards);
+static DEFINE_MUTEX(seeed_clock_mutex);
+static unsigned int seeed_clock_gen = 1;	/* bumped on every change */
+DEFINE_STATIC_SRCU(seeed_clock_srcu);
+
+int seeed_voice_card_register_set_clock(struct device *dev, int stream,
+					int (*set_clock)(int)) {
+	struct seeed_clock_provider *p;
+
+	if (stream < 0 || stream >= _SET_CLOCK_CNT)
+		return -EINVAL;
+
+	mutex_lock(&seeed_clock_mutex);
+	list_for_each_entry(p, &seeed_clock_providers, list) {
+		if (p->dev == dev && p->stream == stream)
+			goto __found;
 	}
+	p = kzalloc(sizeof *p, GFP_KERNEL);
+	if (!p) {
+		mutex_unlock(&seeed_clock_mutex);
+		return -ENOMEM;
+	}
+	p->dev = dev;
+	p->stream = stream;
+	list_add_tail(&p->list, &seeed_clock_providers);
+__found:
+	p->set_clock = set_clock;
+	WRITE_ONCE(seeed_clock_gen, seeed_clock_gen + 1);
+	mutex_unlock(&seeed_clock_mutex);
 	return 0;
 }
 EXPORT_SYMBOL(seeed_voice_card_register_set_clock);
 
+void seeed_voice_card_unregister_set_clock(struct device *dev) {
+	struct seeed_clock_provider *p, *n;
+	struct seeed_card_data *priv;
+	struct seeed_clock_set *set;
+
+	mutex_lock(&seeed_clock_mutex);
+	list_for_each_entry_safe(p, n, &seeed_clock_providers, list) {
+		if (p->dev == dev) {
+			list_del(&p->list);
+			kfree(p);
+		}
+	}
+	WRITE_ONCE(seeed_clock_gen, seeed_clock_gen + 1);
+
+	/* no card calls into it once this returns, they rebind at prepare() */
+	list_for_each_entry(priv, &seeed_clock_cards, clk_node) {
+		set = rcu_dereference_protected(priv->clk_set,
+					lockdep_is_held(&seeed_clock_mutex));
+		if (!set || (set->dev[0] != dev && set->dev[1] != dev))
+			continue;
+		RCU_INIT_POINTER(priv->clk_set, NULL);
+		synchronize_srcu(&seeed_clock_srcu);
+		kfree(set);
+	}
+	mutex_unlock(&seeed_clock_mutex);
+}
+EXPORT_SYMBOL(seeed_voice_card_unregister_set_clock);
+
+static bool seeed_rtd_has_codec_dev(struct snd_soc_pcm_runtime *rtd,
+				    struct device *dev)
+{
+	struct snd_soc_dai *dai;
+	int i;
+
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+	for_each_rtd_codec_dai(rtd, i, dai) {
+	#else
+	for (i = 0; i < rtd->num_codecs; i++) {
+		dai = rtd->codec_dais[i];
+	#endif
+		if (dai->dev == dev)
+			return true;
+	}
+	return false;
+}
+
+/* process context, clk_lock held */
+static void seeed_voice_card_bind_clock(struct seeed_card_data *priv,
+					struct snd_soc_pcm_runtime *rtd)
+{
+	struct seeed_clock_provider *p;
+	struct seeed_clock_set *set, *old;
+
+	if (priv->clk_gen == READ_ONCE(seeed_clock_gen))
+		return;
+
+	set = kzalloc(sizeof *set, GFP_KERNEL);
+	if (!set)
+		return;
+
+	mutex_lock(&seeed_clock_mutex);
+	list_for_each_entry(p, &seeed_clock_providers, list) {
+		if (set->set_clock[p->stream] || !seeed_rtd_has_codec_dev(rtd, p->dev))
+			continue;
+		set->dev[p->stream] = p->dev;
+		set->set_clock[p->stream] = p->set_clock;
+	}
+	old = rcu_dereference_protected(priv->clk_set,
+				lockdep_is_held(&seeed_clock_mutex));
+	rcu_assign_pointer(priv->clk_set, set);
+	priv->clk_gen = seeed_clock_gen;
+	mutex_unlock(&seeed_clock_mutex);
+
+	if (old) {
+		synchronize_srcu(&seeed_clock_srcu);
+		kfree(old);
+	}
+}
+
+static int seeed_voice_card_set_clock(struct seeed_card_data *priv, int cmd)
+{
+	struct seeed_clock_set *set;
+	int r = 0, idx;
+
+	idx = srcu_read_lock(&seeed_clock_srcu);
+	set = srcu_dereference(priv->clk_set, &seeed_clock_srcu);
+	if (set) {
+		/* capture first, AC108 slaves must be armed before AC101 runs LRCK */
+		if (set->set_clock[SNDRV_PCM_STREAM_CAPTURE]) {
+			r = r || set->set_clock[SNDRV_PCM_STREAM_CAPTURE](cmd);
+		}
+		if (set->set_clock[SNDRV_PCM_STREAM_PLAYBACK]) {
+			r = r || set->set_clock[SNDRV_PCM_STREAM_PLAYBACK](cmd);
+		}
+	}
+	srcu_read_unlock(&seeed_clock_srcu, idx);
+	return r;
+}
+
 /*
- * work_cb_codec_clk: clear audio codec inner clock.
+ * trigger_work_fn: commit the codec clock start/stop.
+ *
+ * trigger() runs in atomic context, so the I2C burst is always made here,
+ * from a SCHED_FIFO kthread, as close as possible to the cpu_dai start.
+ * Only the last command counts, a START cancelling a pending STOP.
  */
-static void work_cb_codec_clk(struct work_struct *work)
+static void trigger_work_fn(struct kthread_work *work)
 {
-	struct seeed_card_data *priv = container_of(work, struct seeed_card_data, work_codec_clk);
-	int r = 0;
+	struct seeed_card_data *priv = container_of(work, struct seeed_card_data, trig_work);
+	int cmd, i;
 
-	if (_set_clock[SNDRV_PCM_STREAM_CAPTURE]) {
-		r = r || _set_clock[SNDRV_PCM_STREAM_CAPTURE](0);
-	}
-	if (_set_clock[SNDRV_PCM_STREAM_PLAYBACK]) {
-		r = r || _set_clock[SNDRV_PCM_STREAM_PLAYBACK](0);
+	mutex_lock(&priv->clk_lock);
+	cmd = READ_ONCE(priv->trig_cmd);
+	for (i = 0; i < TRY_STOP_MAX; i++) {
+		if (!seeed_voice_card_set_clock(priv, cmd))
+			break;
 	}
+	mutex_unlock(&priv->clk_lock);
 
-	if (r && priv->try_stop++ < TRY_STOP_MAX) {
-		if (0 != schedule_work(&priv->work_codec_clk)) {}
+	if (i >= TRY_STOP_MAX) {
+		dev_err(seeed_priv_to_dev(priv), "codec clock %s failed\n",
+			cmd == SEEED_CLOCK_START ? "start" : "stop");
 	}
-	return;
+}
+
+static int seeed_voice_card_prepare(struct snd_pcm_substream *substream)
+{
+	struct snd_soc_pcm_runtime *rtd = substream->private_data;
+	struct seeed_card_data *priv = snd_soc_card_get_drvdata(rtd->card);
+	int ret;
+
+	/* an xrun stop must reach the codecs before they are re-armed */
+	kthread_flush_work(&priv->trig_work);
+
+	/* everything but the final enable, so trigger() has little left to do */
+	mutex_lock(&priv->clk_lock);
+	seeed_voice_card_bind_clock(priv, rtd);
+	ret = seeed_voice_card_set_clock(priv, SEEED_CLOCK_PREPARE);
+	mutex_unlock(&priv->clk_lock);
+
+	return ret ? -EIO : 0;
 }
 
 static int seeed_voice_card_trigger(struct snd_pcm_substream *substream, int cmd)
@@ -193,9 +367,6 @@ static int seeed_voice_card_trigger(struct snd_pcm_substream *substream, int cmd
 	struct snd_soc_pcm_runtime *rtd = substream->private_data;
 	struct snd_soc_dai *dai = rtd->codec_dai;
 	struct seeed_card_data *priv = snd_soc_card_get_drvdata(rtd->card);
-	#if CONFIG_AC10X_TRIG_LOCK
-	unsigned long flags;
-	#endif
 	int ret = 0;
 
 	dev_dbg(rtd->card->dev, "%s() stream=%s  cmd=%d play:%d, capt:%d\n",
@@ -206,16 +377,8 @@ static int seeed_voice_card_trigger(struct snd_pcm_substream *substream, int cmd
 	case SNDRV_PCM_TRIGGER_START:
 	case SNDRV_PCM_TRIGGER_RESUME:
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
-		if (cancel_work_sync(&priv->work_codec_clk) != 0) {}
-		#if CONFIG_AC10X_TRIG_LOCK
-		/* I know it will degrades performance, but I have no choice */
-		spin_lock_irqsave(&priv->lock, flags);
-		#endif
-		if (_set_clock[SNDRV_PCM_STREAM_CAPTURE]) _set_clock[SNDRV_PCM_STREAM_CAPTURE](1);
-		if (_set_clock[SNDRV_PCM_STREAM_PLAYBACK]) _set_clock[SNDRV_PCM_STREAM_PLAYBACK](1);
-		#if CONFIG_AC10X_TRIG_LOCK
-		spin_unlock_irqrestore(&priv->lock, flags);
-		#endif
+		WRITE_ONCE(priv->trig_cmd, SEEED_CLOCK_START);
+		kthread_queue_work(priv->trig_worker, &priv->trig_work);
 		break;
 
 	case SNDRV_PCM_TRIGGER_STOP:
@@ -226,15 +389,8 @@ static int seeed_voice_card_trigger(struct snd_pcm_substream *substream, int cmd
 			break;
 		}
 
-		/* interrupt environment */
-		if (in_irq() || in_nmi() || in_serving_softirq()) {
-			priv->try_stop = 0;
-			if (0 != schedule_work(&priv->work_codec_clk)) {
-			}
-		} else {
-			if (_set_clock[SNDRV_PCM_STREAM_CAPTURE]) _set_clock[SNDRV_PCM_STREAM_CAPTURE](0);
-			if (_set_clock[SNDRV_PCM_STREAM_PLAYBACK]) _set_clock[SNDRV_PCM_STREAM_PLAYBACK](0);
-		}
+		WRITE_ONCE(priv->trig_cmd, SEEED_CLOCK_STOP);
+		kthread_queue_work(priv->trig_worker, &priv->trig_work);
 		break;
 	default:
 		ret = -EINVAL;
@@ -243,10 +399,52 @@ static int seeed_voice_card_trigger(struct snd_pcm_substream *substream, int cmd
 	return ret;
 }
 
+static void seeed_voice_card_trigger_release(void *data)
+{
+	struct seeed_card_data *priv = data;
+
+	kthread_destroy_worker(priv->trig_worker);
+
+	mutex_lock(&seeed_clock_mutex);
+	list_del(&priv->clk_node);
+	mutex_unlock(&seeed_clock_mutex);
+	/* the worker is gone, no reader left */
+	kfree(rcu_dereference_protected(priv->clk_set, 1));
+}
+
+static int seeed_voice_card_trigger_init(struct seeed_card_data *priv)
+{
+	struct device *dev = seeed_priv_to_dev(priv);
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+	#endif
+
+	mutex_init(&priv->clk_lock);
+	kthread_init_work(&priv->trig_work, trigger_work_fn);
+
+	priv->trig_worker = kthread_create_worker(0, "%s-trig", dev_name(dev));
+	if (IS_ERR(priv->trig_worker))
+		return PTR_ERR(priv->trig_worker);
+
+	mutex_lock(&seeed_clock_mutex);
+	list_add_tail(&priv->clk_node, &seeed_clock_cards);
+	mutex_unlock(&seeed_clock_mutex);
+
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+	sched_setscheduler_nocheck(priv->trig_worker->task, SCHED_FIFO, &param);
+	#else
+	sched_set_fifo(priv->trig_worker->task);
+	#endif
+
+	/* devm: released after the card, which may still trigger a STOP */
+	return devm_add_action_or_reset(dev, seeed_voice_card_trigger_release, priv);
+}
+
 static struct snd_soc_ops seeed_voice_card_ops = {
 	.startup = seeed_voice_card_startup,
 	.shutdown = seeed_voice_card_shutdown,
 	.hw_params = seeed_voice_card_hw_params,
+	.prepare = seeed_voice_card_prepare,
 	.trigger = seeed_voice_card_trigger,
 };
 
@@ -602,11 +800,9 @@ static int seeed_voice_card_probe(struct platform_device *pdev)
 
 	snd_soc_card_set_drvdata(&priv->snd_card, priv);
 
-	#if CONFIG_AC10X_TRIG_LOCK
-	spin_lock_init(&priv->lock);
-	#endif
-
-	INIT_WORK(&priv->work_codec_clk, work_cb_codec_clk);
+	ret = seeed_voice_card_trigger_init(priv);
+	if (ret < 0)
+		goto err;
 
 	ret = devm_snd_soc_register_card(&pdev->dev, &priv->snd_card);
 	if (ret >= 0)
@@ -621,10 +817,7 @@ err:
 static int seeed_voice_card_remove(struct platform_device *pdev)
 {
 	struct snd_soc_card *card = platform_get_drvdata(pdev);
-	struct seeed_card_data *priv = snd_soc_card_get_drvdata(card);
 
-	if (cancel_work_sync(&priv->work_codec_clk) != 0) {
-	}
 	return asoc_simple_card_clean_reference(card);
 }
 
@@ -0,0 +1,392 @@
+/*
+ * codec-stub.c -- i2c-stub style register model of AC108/AC101/WM8960
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Registers an I2C adapter whose devicetree children are the real codec
+ * nodes of a seeed voicecard. The real drivers probe and run on it, every
+ * transfer lands in a per-chip register file and is counted.
+ *
+ * debugfs seeed-codec-stub/stats:
+ *   read : "xfers <n> bytes <n> last_ns <CLOCK_MONOTONIC ns>" then per chip
+ *   write: anything, clears the counters
+ * debugfs seeed-codec-stub/regs: non zero registers of every chip
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#define STUB_CHIPS_MAX		8
+#define STUB_REGS		256
+
+#define AC108_CHIP_RST		0x00
+#define AC108_CHIP_RST_VAL	0x12
+#define AC101_CHIP_AUDIO_RST	0x00
+#define AC101_CHIP_ID		0x0101
+#define WM8960_RESET		0x0f
+
+/* bus clock in kHz to emulate transfer time, 0 for none */
+static unsigned bus_khz = 400;
+module_param(bus_khz, uint, 0644);
+MODULE_PARM_DESC(bus_khz, "emulated I2C bus clock in kHz, 0 disables the delay");
+
+enum stub_model {
+	STUB_AC108,	/* 8 bit register, 8 bit value */
+	STUB_AC101,	/* 8 bit register, 16 bit big endian value */
+	STUB_WM8960,	/* 7 bit register, 9 bit value, write only */
+};
+
+static const char *const stub_model_name[] = {
+	[STUB_AC108]  = "ac108",
+	[STUB_AC101]  = "ac101",
+	[STUB_WM8960] = "wm8960",
+};
+
+struct stub_chip {
+	u16 addr;
+	enum stub_model model;
+	u8 ptr;				/* register pointer, auto increment */
+	u16 regs[STUB_REGS];
+	u64 reads, writes, bytes;
+};
+
+struct codec_stub {
+	struct i2c_adapter adap;
+	struct mutex lock;
+	int chip_cnt;
+	struct stub_chip chip[STUB_CHIPS_MAX];
+	u64 xfers, bytes;
+	u64 last_ns;
+	struct dentry *debugfs;
+};
+
+static void stub_chip_reset(struct stub_chip *c) {
+	memset(c->regs, 0, sizeof c->regs);
+	if (c->model == STUB_AC101)
+		c->regs[AC101_CHIP_AUDIO_RST] = AC101_CHIP_ID;
+}
+
+static struct stub_chip *stub_find(struct codec_stub *stub, u16 addr) {
+	int i;
+
+	for (i = 0; i < stub->chip_cnt; i++) {
+		if (stub->chip[i].addr == addr)
+			return &stub->chip[i];
+	}
+	return NULL;
+}
+
+static int stub_write(struct stub_chip *c, const u8 *buf, int len) {
+	unsigned reg, val;
+	int i;
+
+	if (len < 1)
+		return 0;
+
+	switch (c->model) {
+	case STUB_AC108:
+		c->ptr = buf[0];
+		for (i = 1; i < len; i++, c->ptr++) {
+			if (c->ptr == AC108_CHIP_RST && buf[i] == AC108_CHIP_RST_VAL) {
+				stub_chip_reset(c);
+				continue;
+			}
+			c->regs[c->ptr] = buf[i];
+		}
+		break;
+
+	case STUB_AC101:
+		c->ptr = buf[0];
+		for (i = 1; i + 1 < len; i += 2, c->ptr++) {
+			if (c->ptr == AC101_CHIP_AUDIO_RST) {
+				stub_chip_reset(c);
+				continue;
+			}
+			c->regs[c->ptr] = (buf[i] << 8) | buf[i + 1];
+		}
+		break;
+
+	case STUB_WM8960:
+		if (len != 2)
+			return -EINVAL;
+		reg = buf[0] >> 1;
+		val = ((buf[0] & 0x01) << 8) | buf[1];
+		if (reg == WM8960_RESET) {
+			stub_chip_reset(c);
+			break;
+		}
+		c->regs[reg] = val;
+		break;
+	}
+	/* a lone register byte only sets the pointer for a read */
+	if (len > 1)
+		c->writes++;
+	return 0;
+}
+
+static int stub_read(struct stub_chip *c, u8 *buf, int len) {
+	int i;
+
+	switch (c->model) {
+	case STUB_AC108:
+		for (i = 0; i < len; i++, c->ptr++) {
+			buf[i] = c->regs[c->ptr];
+		}
+		break;
+
+	case STUB_AC101:
+		for (i = 0; i + 1 < len; i += 2, c->ptr++) {
+			buf[i]     = c->regs[c->ptr] >> 8;
+			buf[i + 1] = c->regs[c->ptr] & 0xFF;
+		}
+		break;
+
+	case STUB_WM8960:
+		/* no read back on the real chip either */
+		return -EOPNOTSUPP;
+	}
+	c->reads++;
+	return 0;
+}
+
+static int stub_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num) {
+	struct codec_stub *stub = i2c_get_adapdata(adap);
+	struct stub_chip *c;
+	unsigned bytes = 0;
+	int i, ret = 0;
+
+	mutex_lock(&stub->lock);
+	for (i = 0; i < num; i++) {
+		c = stub_find(stub, msgs[i].addr);
+		if (!c) {
+			ret = -ENXIO;
+			break;
+		}
+		if (msgs[i].flags & I2C_M_RD)
+			ret = stub_read(c, msgs[i].buf, msgs[i].len);
+		else
+			ret = stub_write(c, msgs[i].buf, msgs[i].len);
+		if (ret)
+			break;
+		/* address byte plus payload */
+		bytes += 1 + msgs[i].len;
+		c->bytes += 1 + msgs[i].len;
+	}
+	stub->xfers++;
+	stub->bytes += bytes;
+	mutex_unlock(&stub->lock);
+
+	/* 9 clocks a byte */
+	if (bus_khz && bytes) {
+		unsigned us = bytes * 9 * 1000 / bus_khz;
+
+		if (us < 10)
+			udelay(us);
+		else
+			usleep_range(us, us + us / 8);
+	}
+
+	mutex_lock(&stub->lock);
+	stub->last_ns = ktime_get_ns();
+	mutex_unlock(&stub->lock);
+
+	return ret ? ret : num;
+}
+
+static u32 stub_func(struct i2c_adapter *adap) {
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm stub_algo = {
+	.master_xfer	= stub_xfer,
+	.functionality	= stub_func,
+};
+
+static int stub_stats_show(struct seq_file *s, void *unused) {
+	struct codec_stub *stub = s->private;
+	int i;
+
+	mutex_lock(&stub->lock);
+	seq_printf(s, "xfers %llu bytes %llu last_ns %llu\n",
+		   stub->xfers, stub->bytes, stub->last_ns);
+	for (i = 0; i < stub->chip_cnt; i++) {
+		struct stub_chip *c = &stub->chip[i];
+
+		seq_printf(s, "0x%02x %-6s reads %llu writes %llu bytes %llu\n",
+			   c->addr, stub_model_name[c->model],
+			   c->reads, c->writes, c->bytes);
+	}
+	mutex_unlock(&stub->lock);
+	return 0;
+}
+
+static int stub_stats_open(struct inode *inode, struct file *file) {
+	return single_open(file, stub_stats_show, inode->i_private);
+}
+
+static ssize_t stub_stats_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos) {
+	struct codec_stub *stub = ((struct seq_file *)file->private_data)->private;
+	int i;
+
+	mutex_lock(&stub->lock);
+	stub->xfers = stub->bytes = 0;
+	for (i = 0; i < stub->chip_cnt; i++) {
+		stub->chip[i].reads = stub->chip[i].writes = stub->chip[i].bytes = 0;
+	}
+	mutex_unlock(&stub->lock);
+	return count;
+}
+
+static const struct file_operations stub_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stub_stats_open,
+	.read		= seq_read,
+	.write		= stub_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int stub_regs_show(struct seq_file *s, void *unused) {
+	struct codec_stub *stub = s->private;
+	int i, r;
+
+	mutex_lock(&stub->lock);
+	for (i = 0; i < stub->chip_cnt; i++) {
+		struct stub_chip *c = &stub->chip[i];
+
+		seq_printf(s, "0x%02x %s\n", c->addr, stub_model_name[c->model]);
+		for (r = 0; r < STUB_REGS; r++) {
+			if (c->regs[r])
+				seq_printf(s, "  %02x: %04x\n", r, c->regs[r]);
+		}
+	}
+	mutex_unlock(&stub->lock);
+	return 0;
+}
+
+static int stub_regs_open(struct inode *inode, struct file *file) {
+	return single_open(file, stub_regs_show, inode->i_private);
+}
+
+static const struct file_operations stub_regs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stub_regs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int stub_parse_chips(struct codec_stub *stub, struct device *dev) {
+	struct device_node *child;
+	const char *compat;
+	u32 addr;
+
+	for_each_available_child_of_node(dev->of_node, child) {
+		struct stub_chip *c;
+
+		if (of_property_read_u32(child, "reg", &addr) ||
+		    of_property_read_string(child, "compatible", &compat))
+			continue;
+		if (stub->chip_cnt >= STUB_CHIPS_MAX) {
+			dev_err(dev, "too many chips, max %d\n", STUB_CHIPS_MAX);
+			of_node_put(child);
+			return -EINVAL;
+		}
+
+		c = &stub->chip[stub->chip_cnt];
+		if (!strncmp(compat, "x-power,ac108", 13))
+			c->model = STUB_AC108;
+		else if (!strcmp(compat, "x-power,ac101"))
+			c->model = STUB_AC101;
+		else if (!strcmp(compat, "wlf,wm8960"))
+			c->model = STUB_WM8960;
+		else {
+			dev_warn(dev, "%s: no model for %s\n", child->name, compat);
+			continue;
+		}
+		c->addr = addr;
+		stub_chip_reset(c);
+		stub->chip_cnt++;
+		dev_info(dev, "0x%02x modeled as %s\n", addr, stub_model_name[c->model]);
+	}
+	return 0;
+}
+
+static int codec_stub_probe(struct platform_device *pdev) {
+	struct device *dev = &pdev->dev;
+	struct codec_stub *stub;
+	int ret;
+
+	stub = devm_kzalloc(dev, sizeof *stub, GFP_KERNEL);
+	if (!stub)
+		return -ENOMEM;
+	mutex_init(&stub->lock);
+
+	ret = stub_parse_chips(stub, dev);
+	if (ret)
+		return ret;
+
+	stub->adap.owner = THIS_MODULE;
+	stub->adap.class = I2C_CLASS_HWMON;
+	stub->adap.algo = &stub_algo;
+	stub->adap.dev.parent = dev;
+	stub->adap.dev.of_node = dev->of_node;
+	strlcpy(stub->adap.name, "seeed codec stub", sizeof stub->adap.name);
+	i2c_set_adapdata(&stub->adap, stub);
+
+	stub->debugfs = debugfs_create_dir("seeed-codec-stub", NULL);
+	if (!IS_ERR_OR_NULL(stub->debugfs)) {
+		debugfs_create_file("stats", S_IRUGO | S_IWUSR, stub->debugfs, stub, &stub_stats_fops);
+		debugfs_create_file("regs", S_IRUGO, stub->debugfs, stub, &stub_regs_fops);
+	}
+	platform_set_drvdata(pdev, stub);
+
+	/* instantiates the codec nodes, the real drivers probe from here */
+	ret = i2c_add_adapter(&stub->adap);
+	if (ret) {
+		debugfs_remove_recursive(stub->debugfs);
+		return ret;
+	}
+	return 0;
+}
+
+static int codec_stub_remove(struct platform_device *pdev) {
+	struct codec_stub *stub = platform_get_drvdata(pdev);
+
+	i2c_del_adapter(&stub->adap);
+	debugfs_remove_recursive(stub->debugfs);
+	return 0;
+}
+
+static const struct of_device_id codec_stub_of_match[] = {
+	{ .compatible = "seeed,codec-i2c-stub", },
+	{},
+};
+MODULE_DEVICE_TABLE(of, codec_stub_of_match);
+
+static struct platform_driver codec_stub_driver = {
+	.driver = {
+		.name = "seeed-codec-stub",
+		.of_match_table = codec_stub_of_match,
+	},
+	.probe = codec_stub_probe,
+	.remove = codec_stub_remove,
+};
+
+module_platform_driver(codec_stub_driver);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("I2C register model of the seeed voicecard codecs");
@@ -0,0 +1,202 @@
+/*
+ * trigger_bench.c -- I2C traffic and latency per hw_params/start/stop
+ *
+ * (C) Copyright 2017-2018
+ * Seeed Technology Co., Ltd. <www.seeedstudio.com>
+ *
+ * Counts the transfers codec-stub sees for each stream phase. Trigger
+ * start/stop are committed asynchronously by the card, so a phase ends
+ * once the bus has been quiet for SETTLE_MS; its latency is the time
+ * from the ALSA call to the last transfer.
+ *
+ * Usage: trigger_bench [-D hw:seeed4micvoicec] [-s stats] [-n loops]
+ *                      [-r rate] [-c channels] [-H max] [-S max] [-T max]
+ * -H/-S/-T fail (exit 1) when hw_params/start/stop average more transfers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+
+#define SETTLE_MS	20
+
+enum { PH_HW_PARAMS, PH_START, PH_STOP, PH_CNT };
+
+static const char *const ph_name[PH_CNT] = { "hw_params", "start", "stop" };
+
+struct stub_stats {
+	unsigned long long xfers, bytes, last_ns;
+};
+
+struct phase {
+	unsigned long long xfers, bytes, ns;
+	unsigned long long ns_max;
+	long max_xfers;
+};
+
+static const char *stats_path = "/sys/kernel/debug/seeed-codec-stub/stats";
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int stats_read(struct stub_stats *st) {
+	FILE *f = fopen(stats_path, "r");
+	int n;
+
+	if (!f) {
+		perror(stats_path);
+		return -1;
+	}
+	n = fscanf(f, "xfers %llu bytes %llu last_ns %llu",
+		   &st->xfers, &st->bytes, &st->last_ns);
+	fclose(f);
+	return n == 3 ? 0 : -1;
+}
+
+static int stats_clear(void) {
+	FILE *f = fopen(stats_path, "w");
+
+	if (!f) {
+		perror(stats_path);
+		return -1;
+	}
+	fputs("0\n", f);
+	fclose(f);
+	return 0;
+}
+
+/* wait until no transfer for SETTLE_MS, then account it to the phase */
+static int phase_end(struct phase *ph, unsigned long long t0) {
+	struct stub_stats st, prev;
+
+	if (stats_read(&prev) < 0)
+		return -1;
+	for (;;) {
+		usleep(SETTLE_MS * 1000);
+		if (stats_read(&st) < 0)
+			return -1;
+		if (st.xfers == prev.xfers)
+			break;
+		prev = st;
+	}
+
+	ph->xfers += st.xfers;
+	ph->bytes += st.bytes;
+	if (st.xfers && st.last_ns > t0) {
+		ph->ns += st.last_ns - t0;
+		if (st.last_ns - t0 > ph->ns_max)
+			ph->ns_max = st.last_ns - t0;
+	}
+	return 0;
+}
+
+static int set_hw_params(snd_pcm_t *pcm, unsigned rate, unsigned channels) {
+	snd_pcm_hw_params_t *hw;
+	int err;
+
+	snd_pcm_hw_params_alloca(&hw);
+	if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0 ||
+	    (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S32_LE)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels(pcm, hw, channels)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate(pcm, hw, rate, 0)) < 0)
+		return err;
+	return snd_pcm_hw_params(pcm, hw);
+}
+
+int main(int argc, char *argv[]) {
+	const char *device = "hw:seeed4micvoicec";
+	struct phase ph[PH_CNT];
+	unsigned rate = 16000, channels = 4;
+	unsigned long long t0;
+	snd_pcm_t *pcm;
+	int loops = 20, i, opt, err, fail = 0;
+
+	memset(ph, 0, sizeof ph);
+	for (i = 0; i < PH_CNT; i++) {
+		ph[i].max_xfers = -1;
+	}
+
+	while ((opt = getopt(argc, argv, "D:s:n:r:c:H:S:T:")) != -1) {
+		switch (opt) {
+		case 'D': device = optarg; break;
+		case 's': stats_path = optarg; break;
+		case 'n': loops = atoi(optarg); break;
+		case 'r': rate = atoi(optarg); break;
+		case 'c': channels = atoi(optarg); break;
+		case 'H': ph[PH_HW_PARAMS].max_xfers = atol(optarg); break;
+		case 'S': ph[PH_START].max_xfers = atol(optarg); break;
+		case 'T': ph[PH_STOP].max_xfers = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-D pcm] [-s stats] [-n loops] [-r rate] [-c channels]"
+				" [-H max] [-S max] [-T max]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (loops <= 0)
+		loops = 1;
+
+	if ((err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+		fprintf(stderr, "open %s: %s\n", device, snd_strerror(err));
+		return 2;
+	}
+
+	for (i = 0; i < loops; i++) {
+		if (stats_clear() < 0)
+			goto out;
+		t0 = now_ns();
+		if ((err = set_hw_params(pcm, rate, channels)) < 0) {
+			fprintf(stderr, "hw_params: %s\n", snd_strerror(err));
+			goto out;
+		}
+		if ((err = snd_pcm_prepare(pcm)) < 0) {
+			fprintf(stderr, "prepare: %s\n", snd_strerror(err));
+			goto out;
+		}
+		if (phase_end(&ph[PH_HW_PARAMS], t0) < 0)
+			goto out;
+
+		stats_clear();
+		t0 = now_ns();
+		if ((err = snd_pcm_start(pcm)) < 0) {
+			fprintf(stderr, "start: %s\n", snd_strerror(err));
+			goto out;
+		}
+		if (phase_end(&ph[PH_START], t0) < 0)
+			goto out;
+
+		stats_clear();
+		t0 = now_ns();
+		snd_pcm_drop(pcm);
+		if (phase_end(&ph[PH_STOP], t0) < 0)
+			goto out;
+
+		snd_pcm_hw_free(pcm);
+	}
+
+	printf("%-10s %10s %10s %12s %12s\n", "phase", "xfers", "bytes", "avg us", "max us");
+	for (i = 0; i < PH_CNT; i++) {
+		double xfers = (double)ph[i].xfers / loops;
+
+		printf("%-10s %10.1f %10.1f %12.1f %12.1f\n", ph_name[i],
+		       xfers, (double)ph[i].bytes / loops,
+		       ph[i].ns / 1000.0 / loops, ph[i].ns_max / 1000.0);
+		if (ph[i].max_xfers >= 0 && xfers > ph[i].max_xfers) {
+			fprintf(stderr, "%s: %.1f transfers, limit %ld\n",
+				ph_name[i], xfers, ph[i].max_xfers);
+			fail = 1;
+		}
+	}
+	snd_pcm_close(pcm);
+	return fail;
+
+out:
+	snd_pcm_close(pcm);
+	return 2;
+}
@@ -8,6 +8,13 @@
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
  * published by the Free Software Foundation.
+ *
+ * Shared by the seeed boards, the flavour is picked at build time:
+ *   default		Raspberry Pi seeed-voicecard, fixed 24MHz MCLK into
+ *			the PLL, clocking configured in slave mode too
+ *   WM8960_JETSON	Jetson Nano tegra machine (jtsn-wm8960/Makefile),
+ *			MCLK rate from the clock framework, ADCLRC as GPIO,
+ *			no MICB routes to the boost mixers
  */
 
 #include <linux/module.h>
@@ -18,6 +25,9 @@
 #include <linux/clk.h>
 #include <linux/i2c.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
@@ -49,6 +59,16 @@
 #define WM8960_DISOP     0x40
 #define WM8960_DRES_MASK 0x30
 
+/* keep PLL locked after the last stream stopped, a reopen skips the lock time */
+static unsigned pll_idle_ms = 5000;
+module_param(pll_idle_ms, uint, 0644);
+MODULE_PARM_DESC(pll_idle_ms, "ms to keep the PLL running after streams stop, 0 stops it at once");
+
+/* capless: keep VMID/VREF charged after the last stream, a restart skips the ramp */
+static int bias_hold_ms = 5000;
+module_param(bias_hold_ms, int, 0644);
+MODULE_PARM_DESC(bias_hold_ms, "ms to keep VMID charged after streams stop, 0 discharges at once, <0 never");
+
 static bool is_pll_freq_available(unsigned int source, unsigned int target);
 static int wm8960_set_pll(struct snd_soc_codec *codec,
 		unsigned int freq_in, unsigned int freq_out);
@@ -67,7 +87,11 @@ static const struct reg_default wm8960_reg_defaults[] = {
 	{  0x6, 0x0000 },
 	{  0x7, 0x000a },
 	{  0x8, 0x01c0 },
+#ifdef WM8960_JETSON
+	{  0x9, 0x0040 }, /* ADCLRC/GPIO1 as GPIO pin */
+#else
 	{  0x9, 0x0000 },
+#endif
 	{  0xa, 0x00ff },
 	{  0xb, 0x00ff },
 
@@ -121,7 +145,42 @@ static bool wm8960_volatile(struct device *dev, unsigned int reg)
 	}
 }
 
+/*
+ * Solved divider settings, keyed on (lrclk, bclk) for the MCLK/SYSCLK
+ * setup in the table header. Common rates are filled in one go when
+ * that setup changes, anything else is solved once and kept.
+ */
+#define WM8960_CLK_TABLE_SIZE	32
+
+struct wm8960_clk_entry {
+	int lrclk;
+	int bclk;
+	int freq_out;		/* PLL output, 0 for SYSCLK from MCLK */
+	u8 sysclkdiv;		/* index of sysclk_divs */
+	u8 dacdiv;		/* index of dac_divs */
+	u8 bclkdiv;		/* index of bclk_divs */
+	s8 ret;			/* 0 or -EINVAL, no solution is kept too */
+};
+
+struct wm8960_clk_table {
+	int freq_in;
+	int sysclk;
+	int clk_id;
+	int cnt;
+	int next;
+	struct wm8960_clk_entry e[WM8960_CLK_TABLE_SIZE];
+};
+
+struct wm8960_bias_stat {
+	unsigned int count;
+	s64 last_ns;
+	s64 max_ns;
+};
+
+#define WM8960_BIAS_LEVELS	(SND_SOC_BIAS_ON + 1)
+
 struct wm8960_priv {
+	struct snd_soc_codec *codec;
 	struct clk *mclk;
 	struct regmap *regmap;
 	int (*set_bias_level)(struct snd_soc_codec *,
@@ -137,6 +196,25 @@ struct wm8960_priv {
 	int freq_in;
 	bool is_stream_in_use[2];
 	struct wm8960_data pdata;
+	struct wm8960_clk_table clk_table;
+
+	/* clocking applied last, configure_clocking() is a no-op while unchanged */
+	struct mutex clk_lock;
+	struct {
+		int freq_in, sysclk, clk_id, bclk, lrclk;
+	} clk_cfg;
+	bool clk_cfg_valid;
+	unsigned int pll_in, pll_out;	/* running PLL, 0 if off */
+	struct delayed_work pll_idle;
+
+	/* VMID/VREF ramps run off the DAPM path, serialized by bias_lock */
+	struct mutex bias_lock;
+	struct work_struct vmid_up;
+	struct delayed_work vmid_down;
+	bool bias_off;			/* cache only, chip may be unpowered */
+	bool vmid_on;			/* VMID/VREF charged */
+	struct wm8960_bias_stat bias_stat[WM8960_BIAS_LEVELS][WM8960_BIAS_LEVELS];
+	struct wm8960_bias_stat vmid_stat[2];	/* background down, up */
 };
 
 #define wm8960_reset(c)	regmap_write(c, WM8960_RESET, 0)
@@ -410,7 +488,9 @@ SND_SOC_DAPM_PGA("OUT3 VMID", WM8960_POWER2, 1, 0, NULL, 0),
 };
 
 static const struct snd_soc_dapm_route audio_paths[] = {
+#ifndef WM8960_JETSON
 	{ "Left Boost Mixer", NULL , "MICB"},
+#endif
 	{ "Left Boost Mixer", "LINPUT1 Switch", "LINPUT1" },
 	{ "Left Boost Mixer", "LINPUT2 Switch", "LINPUT2" },
 	{ "Left Boost Mixer", "LINPUT3 Switch", "LINPUT3" },
@@ -420,7 +500,9 @@ static const struct snd_soc_dapm_route audio_paths[] = {
 	{ "Left Input Mixer", NULL, "LINPUT2" },
 	{ "Left Input Mixer", NULL, "LINPUT3" },
 
+#ifndef WM8960_JETSON
 	{ "Right Boost Mixer", NULL , "MICB"},
+#endif
 	{ "Right Boost Mixer", "RINPUT1 Switch", "RINPUT1" },
 	{ "Right Boost Mixer", "RINPUT2 Switch", "RINPUT2" },
 	{ "Right Boost Mixer", "RINPUT3 Switch", "RINPUT3" },
@@ -612,17 +694,118 @@ static const int bclk_divs[] = {
 	120, 160, 220, 240, 320, 320, 320
 };
 
-static int wm8960_configure_clocking(struct snd_soc_codec *codec)
+/* bclk per frame to prefill: 16, 24 and 32 bit stereo */
+static const int clk_table_fpb[] = { 32, 48, 64 };
+
+static void wm8960_clk_solve(int clk_id, int freq_in, int freq_out,
+			     struct wm8960_clk_entry *e)
+{
+	int sysclk, i, j, k;
+
+	e->ret = -EINVAL;
+	e->freq_out = 0;
+
+	if (clk_id != WM8960_SYSCLK_PLL) {
+		/* check if the sysclk frequency is available. */
+		for (i = 0; i < ARRAY_SIZE(sysclk_divs); ++i) {
+			if (sysclk_divs[i] == -1)
+				continue;
+			sysclk = freq_out / sysclk_divs[i];
+			for (j = 0; j < ARRAY_SIZE(dac_divs); ++j) {
+				if (sysclk != dac_divs[j] * e->lrclk)
+					continue;
+				for (k = 0; k < ARRAY_SIZE(bclk_divs); ++k) {
+					if (sysclk == e->bclk * bclk_divs[k] / 10)
+						goto found;
+				}
+			}
+		}
+		if (clk_id != WM8960_SYSCLK_AUTO)
+			return;
+	}
+
+	/* get a available pll out frequency */
+	for (i = 0; i < ARRAY_SIZE(sysclk_divs); ++i) {
+		if (sysclk_divs[i] == -1)
+			continue;
+		for (j = 0; j < ARRAY_SIZE(dac_divs); ++j) {
+			sysclk = e->lrclk * dac_divs[j];
+			freq_out = sysclk * sysclk_divs[i];
+
+			for (k = 0; k < ARRAY_SIZE(bclk_divs); ++k) {
+				if (sysclk == e->bclk * bclk_divs[k] / 10 &&
+				    is_pll_freq_available(freq_in, freq_out)) {
+					e->freq_out = freq_out;
+					goto found;
+				}
+			}
+		}
+	}
+	return;
+
+found:
+	e->sysclkdiv = i;
+	e->dacdiv = j;
+	e->bclkdiv = k;
+	e->ret = 0;
+}
+
+static struct wm8960_clk_entry *wm8960_clk_add(struct wm8960_clk_table *t,
+					       int lrclk, int bclk)
+{
+	struct wm8960_clk_entry *e = &t->e[t->next];
+	int freq_out;
+
+	t->next = (t->next + 1) % WM8960_CLK_TABLE_SIZE;
+	if (t->cnt < WM8960_CLK_TABLE_SIZE)
+		t->cnt++;
+
+	freq_out = t->clk_id == WM8960_SYSCLK_AUTO ? t->freq_in : t->sysclk;
+	e->lrclk = lrclk;
+	e->bclk = bclk;
+	wm8960_clk_solve(t->clk_id, t->freq_in, freq_out, e);
+	return e;
+}
+
+static const struct wm8960_clk_entry *
+wm8960_clk_lookup(struct wm8960_priv *wm8960, int lrclk, int bclk)
+{
+	struct wm8960_clk_table *t = &wm8960->clk_table;
+	int i, j;
+
+	if (t->freq_in != wm8960->freq_in || t->sysclk != wm8960->sysclk ||
+	    t->clk_id != wm8960->clk_id) {
+		t->freq_in = wm8960->freq_in;
+		t->sysclk = wm8960->sysclk;
+		t->clk_id = wm8960->clk_id;
+		t->cnt = t->next = 0;
+		for (i = 0; i < ARRAY_SIZE(alc_rates); i++) {
+			for (j = 0; j < ARRAY_SIZE(clk_table_fpb); j++)
+				wm8960_clk_add(t, alc_rates[i].rate,
+					       alc_rates[i].rate * clk_table_fpb[j]);
+		}
+	}
+
+	for (i = 0; i < t->cnt; i++) {
+		if (t->e[i].lrclk == lrclk && t->e[i].bclk == bclk)
+			return &t->e[i];
+	}
+	return wm8960_clk_add(t, lrclk, bclk);
+}
+
+static int __wm8960_configure_clocking(struct snd_soc_codec *codec)
 {
 	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
-	int sysclk, bclk, lrclk, freq_out, freq_in;
+	const struct wm8960_clk_entry *e;
+	int bclk, lrclk, freq_in;
 	u16 iface1 = snd_soc_read(codec, WM8960_IFACE1);
-	int i, j, k;
 
 	if (!(iface1 & (1<<6))) {
 		dev_dbg(codec->dev,
 			"Codec is slave mode, no need to configure clock\n");
-		//return 0;
+#ifdef WM8960_JETSON
+		return 0;
+#endif
 	}
 
 	if (wm8960->clk_id != WM8960_SYSCLK_MCLK && !wm8960->freq_in) {
@@ -634,92 +817,290 @@ static int wm8960_configure_clocking(struct snd_soc_codec *codec)
 	bclk = wm8960->bclk;
 	lrclk = wm8960->lrclk;
 
-	//printk("clk_id %d freq_in: %d bclk: %d  lrclk: %d\n",wm8960->clk_id ,freq_in, bclk,lrclk);
+	if (wm8960->clk_id != WM8960_SYSCLK_AUTO && !wm8960->sysclk) {
+		dev_err(codec->dev, "No SYSCLK configured\n");
+		return -EINVAL;
+	}
+
+	e = wm8960_clk_lookup(wm8960, lrclk, bclk);
+	if (e->ret) {
+		dev_err(codec->dev, "failed to configure clock\n");
+		return e->ret;
+	}
 
 	/*
-	 * If it's sysclk auto mode, check if the MCLK can provide sysclk or
-	 * not. If MCLK can provide sysclk, using MCLK to provide sysclk
-	 * directly. Otherwise, auto select a available pll out frequency
-	 * and set PLL.
+	 * If it's sysclk auto mode, MCLK provides sysclk directly when it
+	 * can, the PLL is only used otherwise.
 	 */
-	if (wm8960->clk_id == WM8960_SYSCLK_AUTO) {
-		/* disable the PLL and using MCLK to provide sysclk */
+	if (e->freq_out)
+		wm8960_set_pll(codec, freq_in, e->freq_out);
+	else if (wm8960->clk_id == WM8960_SYSCLK_AUTO)
 		wm8960_set_pll(codec, 0, 0);
-		freq_out = freq_in;
-	} else if (wm8960->sysclk) {
-		freq_out = wm8960->sysclk;
-	} else {
-		dev_err(codec->dev, "No SYSCLK configured\n");
-		return -EINVAL;
+
+	/* configure sysclk, adc and dac frame clock at once */
+	snd_soc_update_bits(codec, WM8960_CLOCK1, 3 << 1 | 0x7 << 3 | 0x7 << 6,
+			    e->sysclkdiv << 1 | e->dacdiv << 3 | e->dacdiv << 6);
+
+	/* configure bit clock */
+	snd_soc_update_bits(codec, WM8960_CLOCK2, 0xf, e->bclkdiv);
+
+	return 0;
+}
+
+static int wm8960_configure_clocking(struct snd_soc_codec *codec)
+{
+	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
+	int ret;
+
+	/* a stream is coming, the PLL has to stay */
+	cancel_delayed_work_sync(&wm8960->pll_idle);
+
+	mutex_lock(&wm8960->clk_lock);
+	if (wm8960->clk_cfg_valid &&
+	    wm8960->clk_cfg.freq_in == wm8960->freq_in &&
+	    wm8960->clk_cfg.sysclk == wm8960->sysclk &&
+	    wm8960->clk_cfg.clk_id == wm8960->clk_id &&
+	    wm8960->clk_cfg.bclk == wm8960->bclk &&
+	    wm8960->clk_cfg.lrclk == wm8960->lrclk) {
+		mutex_unlock(&wm8960->clk_lock);
+		return 0;
 	}
 
-	if (wm8960->clk_id != WM8960_SYSCLK_PLL) {
-		/* check if the sysclk frequency is available. */
-		for (i = 0; i < ARRAY_SIZE(sysclk_divs); ++i) {
-			if (sysclk_divs[i] == -1)
-				continue;
-			sysclk = freq_out / sysclk_divs[i];
-			for (j = 0; j < ARRAY_SIZE(dac_divs); ++j) {
-				if (sysclk != dac_divs[j] * lrclk)
-					continue;
-				for (k = 0; k < ARRAY_SIZE(bclk_divs); ++k)
-					if (sysclk == bclk * bclk_divs[k] / 10)
-						break;
-				if (k != ARRAY_SIZE(bclk_divs))
-					break;
-			}
-			if (j != ARRAY_SIZE(dac_divs))
-				break;
-		}
+	ret = __wm8960_configure_clocking(codec);
+	if (ret == 0) {
+		wm8960->clk_cfg.freq_in = wm8960->freq_in;
+		wm8960->clk_cfg.sysclk = wm8960->sysclk;
+		wm8960->clk_cfg.clk_id = wm8960->clk_id;
+		wm8960->clk_cfg.bclk = wm8960->bclk;
+		wm8960->clk_cfg.lrclk = wm8960->lrclk;
+		wm8960->clk_cfg_valid = true;
+	}
+	mutex_unlock(&wm8960->clk_lock);
 
-		if (i != ARRAY_SIZE(sysclk_divs)) {
-			goto configure_clock;
-		} else if (wm8960->clk_id != WM8960_SYSCLK_AUTO) {
-			dev_err(codec->dev, "failed to configure clock\n");
-			return -EINVAL;
-		}
+	return ret;
+}
+
+/* pll_idle_ms after the last stream, power the PLL down */
+static void wm8960_pll_idle(struct work_struct *work)
+{
+	struct wm8960_priv *wm8960 = container_of(work, struct wm8960_priv,
+						  pll_idle.work);
+	struct snd_soc_codec *codec = wm8960->codec;
+
+	mutex_lock(&wm8960->clk_lock);
+	if (!wm8960->is_stream_in_use[0] && !wm8960->is_stream_in_use[1] &&
+	    wm8960->pll_out) {
+		wm8960_set_pll(codec, 0, 0);
+		wm8960->clk_cfg_valid = false;
 	}
-	/* get a available pll out frequency and set pll */
-	for (i = 0; i < ARRAY_SIZE(sysclk_divs); ++i) {
-		if (sysclk_divs[i] == -1)
-			continue;
-		for (j = 0; j < ARRAY_SIZE(dac_divs); ++j) {
-			sysclk = lrclk * dac_divs[j];
-			freq_out = sysclk * sysclk_divs[i];
+	mutex_unlock(&wm8960->clk_lock);
+}
 
-			for (k = 0; k < ARRAY_SIZE(bclk_divs); ++k) {
-				if (sysclk == bclk * bclk_divs[k] / 10 &&
-				    is_pll_freq_available(freq_in, freq_out)) {
-					wm8960_set_pll(codec,
-						       freq_in, freq_out);
-					break;
-				} else {
-					continue;
-				}
-			}
-			if (k != ARRAY_SIZE(bclk_divs))
-				break;
-		}
-		if (j != ARRAY_SIZE(dac_divs))
-			break;
+/* chip may lose power, relock and reprogram next time */
+static void wm8960_clocking_lost(struct wm8960_priv *wm8960)
+{
+	cancel_delayed_work_sync(&wm8960->pll_idle);
+
+	mutex_lock(&wm8960->clk_lock);
+	wm8960->clk_cfg_valid = false;
+	wm8960->pll_in = wm8960->pll_out = 0;
+	mutex_unlock(&wm8960->clk_lock);
+}
+
+/*
+ * While OFF, register writes only go to the RBTREE cache and are
+ * flushed in one pass on the way back up, the chip may have lost
+ * power in between.
+ */
+static void wm8960_regcache_suspend(struct wm8960_priv *wm8960)
+{
+	mutex_lock(&wm8960->bias_lock);
+	wm8960->bias_off = true;
+	regcache_cache_only(wm8960->regmap, true);
+	regcache_mark_dirty(wm8960->regmap);
+	mutex_unlock(&wm8960->bias_lock);
+}
+
+static void wm8960_regcache_resume(struct wm8960_priv *wm8960)
+{
+	int ret;
+
+	mutex_lock(&wm8960->bias_lock);
+	regcache_cache_only(wm8960->regmap, false);
+	ret = regcache_sync(wm8960->regmap);
+	if (ret)
+		dev_err(wm8960->codec->dev, "Failed to sync cache: %d\n", ret);
+	wm8960->bias_off = false;
+	mutex_unlock(&wm8960->bias_lock);
+}
+
+static void wm8960_bias_stat_add(struct wm8960_bias_stat *st, ktime_t t0)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+	st->count++;
+	st->last_ns = ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+}
+
+/* Enable LOUT1, ROUT1 and OUT3 if they're enabled */
+static void wm8960_capless_outputs(struct wm8960_priv *wm8960)
+{
+	int reg = 0;
+
+	if (wm8960->lout1 && wm8960->lout1->power)
+		reg |= WM8960_PWR2_LOUT1;
+	if (wm8960->rout1 && wm8960->rout1->power)
+		reg |= WM8960_PWR2_ROUT1;
+	if (wm8960->out3 && wm8960->out3->power)
+		reg |= WM8960_PWR2_OUT3;
+	snd_soc_update_bits(wm8960->codec, WM8960_POWER2,
+			    WM8960_PWR2_LOUT1 |
+			    WM8960_PWR2_ROUT1 |
+			    WM8960_PWR2_OUT3, reg);
+}
+
+/* bias_lock held, VMID ends at 2x250k (out3) or 2x50k (capless) */
+static void wm8960_vmid_ramp(struct wm8960_priv *wm8960)
+{
+	struct snd_soc_codec *codec = wm8960->codec;
+	ktime_t t0 = ktime_get();
+
+	if (wm8960->pdata.capless) {
+		/* Enable anti pop mode */
+		snd_soc_update_bits(codec, WM8960_APOP1,
+				    WM8960_POBCTRL | WM8960_SOFT_ST |
+				    WM8960_BUFDCOPEN,
+				    WM8960_POBCTRL | WM8960_SOFT_ST |
+				    WM8960_BUFDCOPEN);
+
+		wm8960_capless_outputs(wm8960);
+
+		/* Enable VMID at 2*50k */
+		snd_soc_update_bits(codec, WM8960_POWER1,
+				    WM8960_VMID_MASK, 0x80);
+
+		/* Ramp */
+		msleep(100);
+
+		/* Enable VREF */
+		snd_soc_update_bits(codec, WM8960_POWER1,
+				    WM8960_VREF, WM8960_VREF);
+
+		msleep(100);
+	} else {
+		/* Enable anti-pop features */
+		snd_soc_write(codec, WM8960_APOP1,
+			      WM8960_POBCTRL | WM8960_SOFT_ST |
+			      WM8960_BUFDCOPEN | WM8960_BUFIOEN);
+
+		/* Enable & ramp VMID at 2x50k */
+		snd_soc_update_bits(codec, WM8960_POWER1, 0x80, 0x80);
+		msleep(100);
+
+		/* Enable VREF */
+		snd_soc_update_bits(codec, WM8960_POWER1, WM8960_VREF,
+				    WM8960_VREF);
+
+		/* Disable anti-pop features */
+		snd_soc_write(codec, WM8960_APOP1, WM8960_BUFIOEN);
+
+		/* Set VMID to 2x250k */
+		snd_soc_update_bits(codec, WM8960_POWER1, 0x180, 0x100);
 	}
 
-	if (i == ARRAY_SIZE(sysclk_divs)) {
-		dev_err(codec->dev, "failed to configure clock\n");
-		return -EINVAL;
+	wm8960->vmid_on = true;
+	wm8960_bias_stat_add(&wm8960->vmid_stat[1], t0);
+}
+
+/* bias_lock held, capless only, out3 keeps VMID up until OFF */
+static void wm8960_vmid_discharge(struct wm8960_priv *wm8960)
+{
+	struct snd_soc_codec *codec = wm8960->codec;
+	ktime_t t0 = ktime_get();
+
+	/* Enable anti-pop mode */
+	snd_soc_update_bits(codec, WM8960_APOP1,
+			    WM8960_POBCTRL | WM8960_SOFT_ST |
+			    WM8960_BUFDCOPEN,
+			    WM8960_POBCTRL | WM8960_SOFT_ST |
+			    WM8960_BUFDCOPEN);
+
+	/* Disable VMID and VREF */
+	snd_soc_update_bits(codec, WM8960_POWER1,
+			    WM8960_VREF | WM8960_VMID_MASK, 0);
+
+	wm8960->vmid_on = false;
+	wm8960_bias_stat_add(&wm8960->vmid_stat[0], t0);
+}
+
+static void wm8960_vmid_up_work(struct work_struct *work)
+{
+	struct wm8960_priv *wm8960 = container_of(work, struct wm8960_priv,
+						  vmid_up);
+
+	mutex_lock(&wm8960->bias_lock);
+	if (!wm8960->bias_off && !wm8960->vmid_on)
+		wm8960_vmid_ramp(wm8960);
+	mutex_unlock(&wm8960->bias_lock);
+}
+
+static void wm8960_vmid_down_work(struct work_struct *work)
+{
+	struct wm8960_priv *wm8960 = container_of(work, struct wm8960_priv,
+						  vmid_down.work);
+
+	mutex_lock(&wm8960->bias_lock);
+	if (!wm8960->bias_off && wm8960->vmid_on)
+		wm8960_vmid_discharge(wm8960);
+	mutex_unlock(&wm8960->bias_lock);
+}
+
+/* a stream is starting, take the held or pre-charged VMID, ramp only if none */
+static void wm8960_vmid_get(struct wm8960_priv *wm8960)
+{
+	cancel_delayed_work_sync(&wm8960->vmid_down);
+	flush_work(&wm8960->vmid_up);
+
+	mutex_lock(&wm8960->bias_lock);
+	if (!wm8960->vmid_on)
+		wm8960_vmid_ramp(wm8960);
+	mutex_unlock(&wm8960->bias_lock);
+}
+
+/* capless, streams stopped, discharge after bias_hold_ms */
+static void wm8960_vmid_put(struct wm8960_priv *wm8960)
+{
+	if (bias_hold_ms < 0)
+		return;
+	if (bias_hold_ms > 0) {
+		mod_delayed_work(system_wq, &wm8960->vmid_down,
+				 msecs_to_jiffies(bias_hold_ms));
+		return;
 	}
 
-configure_clock:
-	/* configure sysclk clock */
-	snd_soc_update_bits(codec, WM8960_CLOCK1, 3 << 1, i << 1);
+	mutex_lock(&wm8960->bias_lock);
+	if (wm8960->vmid_on)
+		wm8960_vmid_discharge(wm8960);
+	mutex_unlock(&wm8960->bias_lock);
+}
 
-	/* configure frame clock */
-	snd_soc_update_bits(codec, WM8960_CLOCK1, 0x7 << 3, j << 3);
-	snd_soc_update_bits(codec, WM8960_CLOCK1, 0x7 << 6, j << 6);
+/* going OFF, no ramp may be left behind */
+static void wm8960_vmid_cancel(struct wm8960_priv *wm8960)
+{
+	cancel_work_sync(&wm8960->vmid_up);
+	cancel_delayed_work_sync(&wm8960->vmid_down);
+}
 
-	/* configure bit clock */
-	snd_soc_update_bits(codec, WM8960_CLOCK2, 0xf, k);
+/* userspace opened a stream, charge VMID while it is set up */
+static int wm8960_startup(struct snd_pcm_substream *substream,
+			  struct snd_soc_dai *dai)
+{
+	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(dai->codec);
 
+	cancel_delayed_work(&wm8960->vmid_down);
+	schedule_work(&wm8960->vmid_up);
 	return 0;
 }
 
@@ -834,6 +1215,9 @@ static int wm8960_set_bias_level_out3(struct snd_soc_codec *codec,
 			if (ret)
 				return ret;
 
+			/* wait for the ramp started at STANDBY */
+			wm8960_vmid_get(wm8960);
+
 			/* Set VMID to 2x50k */
 			snd_soc_update_bits(codec, WM8960_POWER1, 0x180, 0x80);
 			break;
@@ -843,8 +1227,15 @@ static int wm8960_set_bias_level_out3(struct snd_soc_codec *codec,
 			 * If it's sysclk auto mode, and the pll is enabled,
 			 * disable the pll
 			 */
+			mutex_lock(&wm8960->clk_lock);
 			if (wm8960->clk_id == WM8960_SYSCLK_AUTO && (pm2 & 0x1))
 				wm8960_set_pll(codec, 0, 0);
+			mutex_unlock(&wm8960->clk_lock);
+
+			/* otherwise keep it for a while */
+			if (wm8960->clk_id == WM8960_SYSCLK_PLL)
+				mod_delayed_work(system_wq, &wm8960->pll_idle,
+						 msecs_to_jiffies(pll_idle_ms));
 
 			if (!IS_ERR(wm8960->mclk))
 				clk_disable_unprepare(wm8960->mclk);
@@ -858,23 +1249,11 @@ static int wm8960_set_bias_level_out3(struct snd_soc_codec *codec,
 
 	case SND_SOC_BIAS_STANDBY:
 		if (snd_soc_codec_get_bias_level(codec) == SND_SOC_BIAS_OFF) {
-			regcache_sync(wm8960->regmap);
+			wm8960_regcache_resume(wm8960);
 
-			/* Enable anti-pop features */
-			snd_soc_write(codec, WM8960_APOP1,
-				      WM8960_POBCTRL | WM8960_SOFT_ST |
-				      WM8960_BUFDCOPEN | WM8960_BUFIOEN);
-
-			/* Enable & ramp VMID at 2x50k */
-			snd_soc_update_bits(codec, WM8960_POWER1, 0x80, 0x80);
-			msleep(100);
-
-			/* Enable VREF */
-			snd_soc_update_bits(codec, WM8960_POWER1, WM8960_VREF,
-					    WM8960_VREF);
-
-			/* Disable anti-pop features */
-			snd_soc_write(codec, WM8960_APOP1, WM8960_BUFIOEN);
+			/* ramp in the background, PREPARE waits for it */
+			schedule_work(&wm8960->vmid_up);
+			break;
 		}
 
 		/* Set VMID to 2x250k */
@@ -882,6 +1261,10 @@ static int wm8960_set_bias_level_out3(struct snd_soc_codec *codec,
 		break;
 
 	case SND_SOC_BIAS_OFF:
+		wm8960_clocking_lost(wm8960);
+		wm8960_vmid_cancel(wm8960);
+		wm8960->vmid_on = false;
+
 		/* Enable anti-pop features */
 		snd_soc_write(codec, WM8960_APOP1,
 			     WM8960_POBCTRL | WM8960_SOFT_ST |
@@ -890,6 +1273,8 @@ static int wm8960_set_bias_level_out3(struct snd_soc_codec *codec,
 		/* Disable VMID and VREF, let them discharge */
 		snd_soc_write(codec, WM8960_POWER1, 0);
 		msleep(600);
+
+		wm8960_regcache_suspend(wm8960);
 		break;
 	}
 
@@ -901,7 +1286,7 @@ static int wm8960_set_bias_level_capless(struct snd_soc_codec *codec,
 {
 	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
 	u16 pm2 = snd_soc_read(codec, WM8960_POWER2);
-	int reg, ret;
+	int ret;
 
 	switch (level) {
 	case SND_SOC_BIAS_ON:
@@ -910,38 +1295,11 @@ static int wm8960_set_bias_level_capless(struct snd_soc_codec *codec,
 	case SND_SOC_BIAS_PREPARE:
 		switch (snd_soc_codec_get_bias_level(codec)) {
 		case SND_SOC_BIAS_STANDBY:
-			/* Enable anti pop mode */
-			snd_soc_update_bits(codec, WM8960_APOP1,
-					    WM8960_POBCTRL | WM8960_SOFT_ST |
-					    WM8960_BUFDCOPEN,
-					    WM8960_POBCTRL | WM8960_SOFT_ST |
-					    WM8960_BUFDCOPEN);
-
-			/* Enable LOUT1, ROUT1 and OUT3 if they're enabled */
-			reg = 0;
-			if (wm8960->lout1 && wm8960->lout1->power)
-				reg |= WM8960_PWR2_LOUT1;
-			if (wm8960->rout1 && wm8960->rout1->power)
-				reg |= WM8960_PWR2_ROUT1;
-			if (wm8960->out3 && wm8960->out3->power)
-				reg |= WM8960_PWR2_OUT3;
-			snd_soc_update_bits(codec, WM8960_POWER2,
-					    WM8960_PWR2_LOUT1 |
-					    WM8960_PWR2_ROUT1 |
-					    WM8960_PWR2_OUT3, reg);
-
-			/* Enable VMID at 2*50k */
-			snd_soc_update_bits(codec, WM8960_POWER1,
-					    WM8960_VMID_MASK, 0x80);
+			/* held from the last stream or pre-charged at open */
+			wm8960_vmid_get(wm8960);
 
-			/* Ramp */
-			msleep(100);
-
-			/* Enable VREF */
-			snd_soc_update_bits(codec, WM8960_POWER1,
-					    WM8960_VREF, WM8960_VREF);
-
-			msleep(100);
+			/* outputs may differ from when VMID was charged */
+			wm8960_capless_outputs(wm8960);
 
 			if (!IS_ERR(wm8960->mclk)) {
 				ret = clk_prepare_enable(wm8960->mclk);
@@ -964,26 +1322,22 @@ static int wm8960_set_bias_level_capless(struct snd_soc_codec *codec,
 			 * If it's sysclk auto mode, and the pll is enabled,
 			 * disable the pll
 			 */
+			mutex_lock(&wm8960->clk_lock);
 			if (wm8960->clk_id == WM8960_SYSCLK_AUTO && (pm2 & 0x1))
 				wm8960_set_pll(codec, 0, 0);
+			mutex_unlock(&wm8960->clk_lock);
+
+			/* otherwise keep it for a while */
+			if (wm8960->clk_id == WM8960_SYSCLK_PLL)
+				mod_delayed_work(system_wq, &wm8960->pll_idle,
+						 msecs_to_jiffies(pll_idle_ms));
 
 			if (!IS_ERR(wm8960->mclk))
 				clk_disable_unprepare(wm8960->mclk);
-
-			/* Enable anti-pop mode */
-			snd_soc_update_bits(codec, WM8960_APOP1,
-					    WM8960_POBCTRL | WM8960_SOFT_ST |
-					    WM8960_BUFDCOPEN,
-					    WM8960_POBCTRL | WM8960_SOFT_ST |
-					    WM8960_BUFDCOPEN);
-
-			/* Disable VMID and VREF */
-			snd_soc_update_bits(codec, WM8960_POWER1,
-					    WM8960_VREF | WM8960_VMID_MASK, 0);
 			break;
 
 		case SND_SOC_BIAS_OFF:
-			regcache_sync(wm8960->regmap);
+			wm8960_regcache_resume(wm8960);
 			break;
 		default:
 			break;
@@ -992,6 +1346,10 @@ static int wm8960_set_bias_level_capless(struct snd_soc_codec *codec,
 
 	case SND_SOC_BIAS_STANDBY:
 		switch (snd_soc_codec_get_bias_level(codec)) {
+		case SND_SOC_BIAS_OFF:
+			wm8960_regcache_resume(wm8960);
+			break;
+
 		case SND_SOC_BIAS_PREPARE:
 			/* Disable HP discharge */
 			snd_soc_update_bits(codec, WM8960_APOP2,
@@ -1004,6 +1362,9 @@ static int wm8960_set_bias_level_capless(struct snd_soc_codec *codec,
 					    WM8960_BUFDCOPEN,
 					    WM8960_POBCTRL | WM8960_SOFT_ST |
 					    WM8960_BUFDCOPEN);
+
+			/* VMID and VREF go after bias_hold_ms */
+			wm8960_vmid_put(wm8960);
 			break;
 
 		default:
@@ -1012,6 +1373,15 @@ static int wm8960_set_bias_level_capless(struct snd_soc_codec *codec,
 		break;
 
 	case SND_SOC_BIAS_OFF:
+		wm8960_clocking_lost(wm8960);
+		wm8960_vmid_cancel(wm8960);
+
+		mutex_lock(&wm8960->bias_lock);
+		if (wm8960->vmid_on)
+			wm8960_vmid_discharge(wm8960);
+		mutex_unlock(&wm8960->bias_lock);
+
+		wm8960_regcache_suspend(wm8960);
 		break;
 	}
 
@@ -1023,6 +1393,7 @@ struct _pll_div {
 	u32 pre_div:1;
 	u32 n:4;
 	u32 k:24;
+	u32 sysclk_div:2;
 };
 
 static bool is_pll_freq_available(unsigned int source, unsigned int target)
@@ -1062,11 +1433,18 @@ static int pll_factors(unsigned int source, unsigned int target,
 	/* Scale up target to PLL operating frequency */
 	target *= 4;
 
+	pll_div->sysclk_div = 0;
 	Ndiv = target / source;
 	if (Ndiv < 6) {
 		source >>= 1;
 		pll_div->pre_div = 1;
 		Ndiv = target / source;
+		if (Ndiv < 6) {
+			/* run the PLL at twice the target, SYSCLK divides it back */
+			target <<= 1;
+			pll_div->sysclk_div = 0x2;
+			Ndiv = target / source;
+		}
 	} else
 		pll_div->pre_div = 0;
 
@@ -1101,10 +1479,16 @@ static int pll_factors(unsigned int source, unsigned int target,
 static int wm8960_set_pll(struct snd_soc_codec *codec,
 		unsigned int freq_in, unsigned int freq_out)
 {
+	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
 	u16 reg;
 	static struct _pll_div pll_div;
 	int ret;
 
+	/* already locked to it, don't wait for the lock again */
+	if (freq_in && freq_out &&
+	    wm8960->pll_in == freq_in && wm8960->pll_out == freq_out)
+		return 0;
+
 	if (freq_in && freq_out) {
 		ret = pll_factors(freq_in, freq_out, &pll_div);
 		if (ret != 0)
@@ -1115,9 +1499,12 @@ static int wm8960_set_pll(struct snd_soc_codec *codec,
 	 * PLL needs to be disabled while we do so. */
 	snd_soc_update_bits(codec, WM8960_CLOCK1, 0x1, 0);
 	snd_soc_update_bits(codec, WM8960_POWER2, 0x1, 0);
+	wm8960->pll_in = wm8960->pll_out = 0;
 
-	if (!freq_in || !freq_out)
+	if (!freq_in || !freq_out) {
+		wm8960->clk_cfg_valid = false;
 		return 0;
+	}
 
 	reg = snd_soc_read(codec, WM8960_PLL1) & ~0x3f;
 	reg |= pll_div.pre_div << 4;
@@ -1131,11 +1518,15 @@ static int wm8960_set_pll(struct snd_soc_codec *codec,
 		snd_soc_write(codec, WM8960_PLL4, pll_div.k & 0xff);
 	}
 	snd_soc_write(codec, WM8960_PLL1, reg);
+	snd_soc_update_bits(codec, WM8960_CLOCK1, 0x3 << 1,
+			    pll_div.sysclk_div << 1);
 
 	/* Turn it on */
 	snd_soc_update_bits(codec, WM8960_POWER2, 0x1, 0x1);
 	msleep(250);
 	snd_soc_update_bits(codec, WM8960_CLOCK1, 0x1, 0x1);
+	wm8960->pll_in = freq_in;
+	wm8960->pll_out = freq_out;
 
 	return 0;
 }
@@ -1146,20 +1537,28 @@ static int wm8960_set_dai_pll(struct snd_soc_dai *codec_dai, int pll_id,
 
 	struct snd_soc_codec *codec = codec_dai->codec;
 	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
+	int ret;
 
 	wm8960->freq_in = freq_in;
 
 	if (pll_id == WM8960_SYSCLK_AUTO)
 		return 0;
-	return wm8960_set_pll(codec, freq_in, freq_out);
+
+	mutex_lock(&wm8960->clk_lock);
+	ret = wm8960_set_pll(codec, freq_in, freq_out);
+	mutex_unlock(&wm8960->clk_lock);
+	return ret;
 }
 
 static int wm8960_set_dai_clkdiv(struct snd_soc_dai *codec_dai,
 		int div_id, int div)
 {
 	struct snd_soc_codec *codec = codec_dai->codec;
+	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
 	u16 reg;
 
+	/* dividers set by hand, recompute them on the next stream */
+	wm8960->clk_cfg_valid = false;
 
 	switch (div_id) {
 	case WM8960_SYSCLKDIV:
@@ -1193,8 +1592,13 @@ static int wm8960_set_bias_level(struct snd_soc_codec *codec,
 				 enum snd_soc_bias_level level)
 {
 	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
+	enum snd_soc_bias_level from = snd_soc_codec_get_bias_level(codec);
+	ktime_t t0 = ktime_get();
+	int ret;
 
-	return wm8960->set_bias_level(codec, level);
+	ret = wm8960->set_bias_level(codec, level);
+	wm8960_bias_stat_add(&wm8960->bias_stat[from][level], t0);
+	return ret;
 }
 
 static int wm8960_set_dai_sysclk(struct snd_soc_dai *dai, int clk_id,
@@ -1203,7 +1607,11 @@ static int wm8960_set_dai_sysclk(struct snd_soc_dai *dai, int clk_id,
 
 	struct snd_soc_codec *codec = dai->codec;
 	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
+#ifdef WM8960_JETSON
+	unsigned int osc_clk = clk_get_rate(wm8960->mclk);
+#else
 	clk_id = WM8960_SYSCLK_PLL;
+#endif
 
 	switch (clk_id) {
 	case WM8960_SYSCLK_MCLK:
@@ -1213,13 +1621,22 @@ static int wm8960_set_dai_sysclk(struct snd_soc_dai *dai, int clk_id,
 	case WM8960_SYSCLK_PLL:
 		snd_soc_update_bits(codec, WM8960_CLOCK1,
 					0x1, WM8960_SYSCLK_PLL);
+#ifdef WM8960_JETSON
+		/* fall through */
+	case WM8960_SYSCLK_AUTO:
+		wm8960_set_dai_pll(dai, clk_id, 0, osc_clk, freq);
+		break;
+#else
 		break;
 	case WM8960_SYSCLK_AUTO:
 		break;
+#endif
 	default:
 		return -EINVAL;
 	}
+#ifndef WM8960_JETSON
 	wm8960->freq_in = 24000000;
+#endif
 	wm8960->sysclk = freq;
 	wm8960->clk_id = clk_id;
 
@@ -1233,6 +1650,7 @@ static int wm8960_set_dai_sysclk(struct snd_soc_dai *dai, int clk_id,
 	SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S32_LE)
 
 static const struct snd_soc_dai_ops wm8960_dai_ops = {
+	.startup = wm8960_startup,
 	.hw_params = wm8960_hw_params,
 	.hw_free = wm8960_hw_free,
 	.digital_mute = wm8960_mute,
@@ -1265,6 +1683,7 @@ static int wm8960_probe(struct snd_soc_codec *codec)
 	struct wm8960_priv *wm8960 = snd_soc_codec_get_drvdata(codec);
 	struct wm8960_data *pdata = &wm8960->pdata;
 
+	wm8960->codec = codec;
 	if (pdata->capless)
 		wm8960->set_bias_level = wm8960_set_bias_level_capless;
 	else
@@ -1289,6 +1708,57 @@ static const struct snd_soc_codec_driver soc_codec_dev_wm8960 = {
 	#endif
 };
 
+static const char *const wm8960_bias_name[WM8960_BIAS_LEVELS] = {
+	[SND_SOC_BIAS_OFF]	= "OFF",
+	[SND_SOC_BIAS_STANDBY]	= "STANDBY",
+	[SND_SOC_BIAS_PREPARE]	= "PREPARE",
+	[SND_SOC_BIAS_ON]	= "ON",
+};
+
+/* time spent in each bias transition and in the background VMID ramps */
+static ssize_t wm8960_bias_stats_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct wm8960_priv *wm8960 = dev_get_drvdata(dev);
+	struct wm8960_bias_stat *st;
+	ssize_t n = 0;
+	int i, j;
+
+	n += snprintf(buf + n, PAGE_SIZE - n, "%-18s %8s %10s %10s\n",
+		      "transition", "count", "last_us", "max_us");
+	for (i = 0; i < WM8960_BIAS_LEVELS; i++) {
+		for (j = 0; j < WM8960_BIAS_LEVELS; j++) {
+			st = &wm8960->bias_stat[i][j];
+			if (!st->count)
+				continue;
+			n += snprintf(buf + n, PAGE_SIZE - n,
+				      "%8s->%-8s %8u %10lld %10lld\n",
+				      wm8960_bias_name[i], wm8960_bias_name[j],
+				      st->count, st->last_ns / 1000,
+				      st->max_ns / 1000);
+		}
+	}
+	for (i = 1; i >= 0; i--) {
+		st = &wm8960->vmid_stat[i];
+		n += snprintf(buf + n, PAGE_SIZE - n,
+			      "%-18s %8u %10lld %10lld\n",
+			      i ? "vmid_up" : "vmid_down",
+			      st->count, st->last_ns / 1000,
+			      st->max_ns / 1000);
+	}
+	return n;
+}
+
+static DEVICE_ATTR(bias_stats, 0444, wm8960_bias_stats_show, NULL);
+static struct attribute *wm8960_debug_attrs[] = {
+	&dev_attr_bias_stats.attr,
+	NULL,
+};
+static struct attribute_group wm8960_debug_attr_group = {
+	.name   = "wm8960_debug",
+	.attrs  = wm8960_debug_attrs,
+};
+
 static const struct regmap_config wm8960_regmap = {
 	.reg_bits = 7,
 	.val_bits = 9,
@@ -1325,7 +1795,15 @@ static int wm8960_i2c_probe(struct i2c_client *i2c,
 	if (wm8960 == NULL)
 		return -ENOMEM;
 
+#ifndef WM8960_JETSON
 	wm8960->clk_id = WM8960_SYSCLK_PLL;
+#endif
+	mutex_init(&wm8960->clk_lock);
+	INIT_DELAYED_WORK(&wm8960->pll_idle, wm8960_pll_idle);
+	mutex_init(&wm8960->bias_lock);
+	INIT_WORK(&wm8960->vmid_up, wm8960_vmid_up_work);
+	INIT_DELAYED_WORK(&wm8960->vmid_down, wm8960_vmid_down_work);
+	wm8960->bias_off = true;
 
 	wm8960->mclk = devm_clk_get(&i2c->dev, "mclk");
 
@@ -1373,15 +1851,27 @@ static int wm8960_i2c_probe(struct i2c_client *i2c,
 
 	i2c_set_clientdata(i2c, wm8960);
 
+	ret = sysfs_create_group(&i2c->dev.kobj, &wm8960_debug_attr_group);
+	if (ret) {
+		dev_err(&i2c->dev, "failed to create attr group\n");
+	}
+
 	ret = snd_soc_register_codec(&i2c->dev,
 			&soc_codec_dev_wm8960, &wm8960_dai, 1);
+	if (ret)
+		sysfs_remove_group(&i2c->dev.kobj, &wm8960_debug_attr_group);
 
 	return ret;
 }
 
 static int wm8960_i2c_remove(struct i2c_client *client)
 {
+	struct wm8960_priv *wm8960 = i2c_get_clientdata(client);
+
 	snd_soc_unregister_codec(&client->dev);
+	cancel_delayed_work_sync(&wm8960->pll_idle);
+	wm8960_vmid_cancel(wm8960);
+	sysfs_remove_group(&client->dev.kobj, &wm8960_debug_attr_group);
 	return 0;
 }
 